@@ -0,0 +1,24 @@
+#ifndef BLOCKDEV_H
+#define BLOCKDEV_H
+
+#include <stdint.h>
+
+// Raw storage under LogStore, with NOR flash rules: erase sets whole
+// erase units to 0xFF, program only clears bits and is done in whole
+// program units. Implemented by SpiNor on the board and by a file on the
+// host (host/file_device.h). Calls return 0, or -1 on a device error.
+class BlockDevice {
+    public:
+    
+    virtual int read(uint32_t addr, void *data, uint32_t n) = 0;
+    // addr and n are multiples of program_size()
+    virtual int program(uint32_t addr, const void *data, uint32_t n) = 0;
+    // addr and n are multiples of erase_size()
+    virtual int erase(uint32_t addr, uint32_t n) = 0;
+    
+    virtual uint32_t size() = 0;
+    virtual uint32_t erase_size() = 0;
+    virtual uint32_t program_size() = 0;
+};
+
+#endif
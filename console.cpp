@@ -0,0 +1,289 @@
+#include "console.h"
+#include "script.h"
+#include "profile.h"
+#include <algorithm>
+
+Keyboard * keyboard;
+Thread * keyboard_addr;
+bool console_quiet = false;
+
+static Serial * console_pc;
+static void (*console_interpret)();
+static bool console_wait_ready;
+
+// Longest a script waits without looking for a key that stops it
+#define SCRIPT_POLL_MS 100
+
+static Script script;
+static volatile int script_waiting = 0;
+static FILE * script_record = NULL;
+static uint32_t script_recorded_ms;
+// Millisecond clock off the microsecond ticker, which wraps every 71
+// minutes; playback reads it every SCRIPT_POLL_MS, but a gap that long
+// between two recorded commands comes out short
+static uint32_t script_last_ticks;
+static uint64_t script_elapsed_us;
+
+static void serial_output(const char * s, int n) {
+    for (int i = 0; i < n; i++) {
+        console_pc->putc(s[i]);
+    }
+}
+
+void (*console_output)(const char * s, int n) = &serial_output;
+
+void console_print(const char * s) {
+    console_output(s, strlen(s));
+}
+
+void console_print(const Format & f) {
+    console_output(f.c_str(), f.length());
+}
+
+void console_init(Serial * pc, Keyboard * kb, void (*interpret)(), bool wait_ready) {
+    console_pc = pc;
+    console_interpret = interpret;
+    console_wait_ready = wait_ready;
+    keyboard = kb;
+}
+
+void console_event(int signal) {
+    if (script_waiting & signal) keyboard_addr->signal_set(signal);
+}
+
+static uint32_t script_now() {
+    uint32_t t = us_ticker_read();
+    script_elapsed_us += t - script_last_ticks;
+    script_last_ticks = t;
+    return (uint32_t) (script_elapsed_us / 1000);
+}
+
+// The current command as text, without the ~ padding
+static void command_text(char * text) {
+    int n = 0;
+    while (n < SCRIPT_COMMAND - 1 && keyboard->command[n] != '~') {
+        text[n] = keyboard->command[n];
+        n++;
+    }
+    text[n] = '\0';
+}
+
+static void script_start_recording() {
+    if (script_record != NULL) {
+        console_print("\n\rAlready recording");
+        return;
+    }
+    FormatBuffer<32> filename;
+    for (int n = 0; ; n++) {
+        filename.clear();
+        filename << "/local/scr" << pad(n, 3, '0') << ".txt";
+        FILE * fp = fopen(filename.c_str(), "r");
+        if (fp == NULL) break;
+        fclose(fp);
+    }
+    script_record = fopen(filename.c_str(), "w");
+    if (script_record == NULL) {
+        console_print(FormatLine() << "\n\rCannot create " << filename.c_str());
+        return;
+    }
+    script_recorded_ms = script_now();
+    console_print(FormatLine() << "\n\rRecording to " << filename.c_str());
+}
+
+static void script_stop_recording() {
+    if (script_record != NULL) {
+        fclose(script_record);
+        script_record = NULL;
+        console_print("\n\rRecording stopped");
+    }
+}
+
+// Appends the command just completed, timed from the one before
+static void script_note() {
+    if (script_record == NULL) return;
+    char text[SCRIPT_COMMAND];
+    command_text(text);
+    uint32_t now = script_now();
+    fputs((FormatLine() << '+' << (now - script_recorded_ms) << ' ' << text << '\n').c_str(),
+        script_record);
+    script_recorded_ms = now;
+}
+
+// Sleeps until script_now() reaches due, or until event arrives when set;
+// due < 0 waits for the event forever. Returns 1 when due or the event
+// came, 0 when the event did not, -1 when a key stopped the script.
+static int script_wait(int64_t due, int event) {
+    // Drop an event that came after the last wait gave up on it
+    if (event) Thread::signal_wait(event, 0);
+    script_waiting = event;
+    int result = -1;
+    while (!console_pc->readable()) {
+        int64_t left = due < 0 ? SCRIPT_POLL_MS : due - (int64_t) script_now();
+        if (left <= 0) {
+            result = event ? 0 : 1;
+            break;
+        }
+        int ms = (int) std::min(left, (int64_t) SCRIPT_POLL_MS);
+        if (event) {
+            if (Thread::signal_wait(event, ms).status == osEventSignal) {
+                result = 1;
+                break;
+            }
+        } else {
+            Thread::wait(ms);
+        }
+    }
+    script_waiting = 0;
+    if (result < 0) console_pc->getc();
+    return result;
+}
+
+// Runs command as if typed
+static void script_send(const char * command) {
+    if (command[0] == 'k' || command[0] == 'K') {
+        console_print("\n\rScripts cannot run k commands");
+        return;
+    }
+    keyboard->reset_command();
+    for (int i = 0; command[i] != '\0'; i++) {
+        keyboard->read_char(command[i]);
+    }
+    if (!console_quiet) console_print(FormatLine() << "\n\r$ " << command);
+    console_interpret();
+    keyboard->reset_command();
+    if (console_wait_ready) Thread::signal_wait(INPUT_READY);
+}
+
+static void script_run() {
+    if (!script.finish()) {
+        console_print(FormatLine() << "\n\rScript line " << script.error_line
+            << ": " << script.error);
+        return;
+    }
+    console_print(FormatLine() << "\n\rScript of " << script.count
+        << " steps, any key stops it");
+    // Sends keep to the recorded schedule; a wait restarts it
+    int64_t due = script_now();
+    int remaining[SCRIPT_DEPTH];
+    int depth = 0;
+    int sent = 0;
+    int result = 1;
+    int i = 0;
+    while (i < script.count && result > 0) {
+        ScriptStep * step = &script.steps[i];
+        i++;
+        if (step->op == SCRIPT_SEND) {
+            due += step->arg;
+            result = script_wait(due, 0);
+            if (result > 0) {
+                script_send(step->command);
+                sent++;
+            }
+        } else if (step->op == SCRIPT_WAIT) {
+            int64_t now = script_now();
+            result = script_wait(step->event && step->arg == 0 ? -1 : now + step->arg,
+                step->event);
+            if (result == 0) {
+                console_print(FormatLine() << "\n\rScript line " << step->line
+                    << ": no " << script_event_name(step->event) << " in "
+                    << (unsigned long) step->arg << "ms");
+            }
+            due = script_now();
+        } else if (step->op == SCRIPT_LOOP) {
+            // 0 runs forever
+            remaining[depth++] = step->arg == 0 ? -1 : (int) step->arg;
+        } else if (step->op == SCRIPT_END) {
+            int * left = &remaining[depth - 1];
+            if (*left < 0 || --*left > 0) {
+                i = step->arg + 1;
+            } else {
+                depth--;
+            }
+        }
+    }
+    console_print(FormatLine() << "\n\rScript " << (result > 0 ? "done" :
+        result == 0 ? "failed" : "stopped") << ", " << sent << " commands sent");
+}
+
+static void script_play_file(int n) {
+    FormatBuffer<32> filename;
+    filename << "/local/scr" << pad(n, 3, '0') << ".txt";
+    FILE * fp = fopen(filename.c_str(), "r");
+    if (fp == NULL) {
+        console_print(FormatLine() << "\n\rNo script " << filename.c_str());
+        return;
+    }
+    script.clear();
+    char line[SCRIPT_LINE];
+    int line_no = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        script.parse_line(line, ++line_no);
+    }
+    fclose(fp);
+    script_run();
+}
+
+// Reads lines from the link until one holding only a dot
+static void script_play_host() {
+    console_print("\n\rSend the script, end it with a line holding .");
+    script.clear();
+    char line[SCRIPT_LINE];
+    int n = 0;
+    int line_no = 0;
+    while (true) {
+        char c = console_pc->getc();
+        if (c != '\r' && c != '\n') {
+            if (n < SCRIPT_LINE - 1) line[n++] = c;
+            continue;
+        }
+        line[n] = '\0';
+        if (n == 0) continue;
+        if (n == 1 && line[0] == '.') break;
+        script.parse_line(line, ++line_no);
+        n = 0;
+    }
+    script_run();
+}
+
+static void script_command() {
+    char c = keyboard->command[1];
+    if (c == 'r') {
+        script_start_recording();
+    } else if (c == 's') {
+        script_stop_recording();
+    } else if (c == 'h') {
+        script_play_host();
+    } else if (c >= '0' && c <= '9') {
+        script_play_file(keyboard->read_number(1));
+    } else {
+        console_print("\n\rkr record, ks stop, k<n> play scrNNN, kh play from the link");
+    }
+}
+
+void input_thread(void const * args) {
+    script_last_ticks = us_ticker_read();
+    keyboard->prompt();
+    keyboard->reset_command();
+    while(1) {
+        keyboard->last_keyboard = console_pc->getc();
+        keyboard->read_char(keyboard->last_keyboard);
+        
+        if (keyboard->last_keyboard != '\r' && !console_quiet) {
+            PROFILE_SCOPE("echo");
+            console_pc->putc(keyboard->last_keyboard);
+        }
+        
+        if (keyboard->last_keyboard == '\r' || keyboard->command_complete()) {
+            if (keyboard->command[0] == 'k' || keyboard->command[0] == 'K') {
+                script_command();
+                keyboard->reset_command();
+            } else {
+                script_note();
+                console_interpret();
+                keyboard->reset_command();
+                if (console_wait_ready) Thread::signal_wait(INPUT_READY);
+            }
+            if (!console_quiet) keyboard->prompt();
+        }
+    }
+}
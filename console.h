@@ -0,0 +1,38 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include "mbed.h"
+#include "rtos.h"
+#include "keyboard.h"
+#include "signals.h"
+#include "format.h"
+
+// Line-oriented command console on the USB serial link. The k command
+// records and plays scripts of console commands (script.h):
+//   k        help
+//   kr, ks   start and stop recording to /local/scrNNN.txt
+//   k<n>     play /local/scrNNN.txt
+//   kh       play a script sent over the link, ended by a line with a .
+extern Keyboard * keyboard;
+extern Thread * keyboard_addr;
+// No echo or prompt, e.g. while the link carries telemetry
+extern bool console_quiet;
+
+// interpret is called for every completed command. With wait_ready the
+// console waits for INPUT_READY before it prompts again.
+void console_init(Serial * pc, Keyboard * kb, void (*interpret)(), bool wait_ready);
+
+void input_thread(void const * args);
+
+// Wakes a script waiting for signal (AP, AS, VP or VS); safe from
+// interrupts. Boards call it on every pace and sense.
+void console_event(int signal);
+
+// Where console text goes: the serial port, unless a board reroutes it,
+// as the heart does into telemetry frames
+extern void (*console_output)(const char * s, int n);
+
+void console_print(const char * s);
+void console_print(const Format & f);
+
+#endif
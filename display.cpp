@@ -0,0 +1,59 @@
+#include "display.h"
+#include "profile.h"
+#include <algorithm>
+
+using namespace std;
+
+Thread * display_addr;
+int observation_interval = 10000;
+void (*display_report)(int count, int interval) = NULL;
+
+void set_observation_interval(int interval) {
+    observation_interval = interval;
+    display_addr->signal_set(INTERVAL_CHANGE);
+}
+
+void lcd_print(TextLCD * lcd, const char * s) {
+    while (*s) {
+        lcd->putc(*s++);
+    }
+}
+
+void lcd_print(TextLCD * lcd, const Format & f) {
+    lcd_print(lcd, f.c_str());
+}
+
+void display_thread(void const * args) {
+    TextLCD * lcd = (TextLCD *) args;
+    Timer t;
+    int count = 0;
+    lcd_print(lcd, "Initialized\n\n");
+    t.reset();
+    t.start();
+    while (true) {
+        osEvent sig = Thread::signal_wait(0x00, max(observation_interval - t.read_ms(), 1));
+        int signum = sig.value.signals;
+        if ((signum & VP) || (signum & VS)) {
+            count++;
+        } else if (signum & INTERVAL_CHANGE) {
+            t.reset();
+            count = 0;
+            lcd->locate(0,0);
+            lcd_print(lcd, "Initialized\n\n");
+        } else {
+            PROFILE_SCOPE("lcd");
+            // Tenths of a BPM
+            // In 64 bits: count * 600000 overflows past 3579 beats, which
+            // stress mode passes within a second
+            int bpm = observation_interval > 0 ?
+                (int) ((int64_t) count * 600000 / observation_interval) : 0;
+            lcd->locate(0,0);
+            lcd_print(lcd, FormatBuffer<17>() << fixed(bpm, 1, 5) << " BPM   ");
+            if (display_report != NULL) {
+                display_report(count, observation_interval);
+            }
+            count = 0;
+            t.reset();
+        }
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+#include "mbed.h"
+#include "rtos.h"
+#include "TextLCD.h"
+#include "signals.h"
+#include "format.h"
+
+// Counts VP/VS signals and shows the rate on the first LCD line at the
+// end of every observation interval.
+extern Thread * display_addr;
+extern int observation_interval;
+
+// Optional hook, called with the beat count of every finished interval
+extern void (*display_report)(int count, int interval);
+
+void set_observation_interval(int interval);
+
+// args: the TextLCD to write to
+void display_thread(void const * args);
+
+// Write at the cursor, without going through printf
+void lcd_print(TextLCD * lcd, const char * s);
+void lcd_print(TextLCD * lcd, const Format & f);
+
+#endif
@@ -0,0 +1,136 @@
+#include "format.h"
+
+static const char digit_chars[] = "0123456789abcdef";
+
+static const uint32_t powers_of_ten[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+    1000000000
+};
+
+Format::Format(char *_buffer, int _size) : buffer(_buffer), size(_size),
+    used(0), overflow(false) {
+    buffer[0] = '\0';
+}
+
+Format &Format::operator<<(const char *s) {
+    while (*s) {
+        put(*s++);
+    }
+    return *this;
+}
+
+Format &Format::operator<<(char c) {
+    put(c);
+    return *this;
+}
+
+Format &Format::operator<<(int v) {
+    return *this << (long) v;
+}
+
+Format &Format::operator<<(unsigned v) {
+    return *this << (unsigned long) v;
+}
+
+Format &Format::operator<<(long v) {
+    uint32_t magnitude = v < 0 ? 0u - (uint32_t) v : (uint32_t) v;
+    number(magnitude, v < 0, 0, ' ', 10, 1);
+    return *this;
+}
+
+Format &Format::operator<<(unsigned long v) {
+    number((uint32_t) v, false, 0, ' ', 10, 1);
+    return *this;
+}
+
+// Only split into 64-bit divisions when it does not fit 32 bits
+Format &Format::operator<<(unsigned long long v) {
+    if (v <= 0xFFFFFFFFu) {
+        return *this << (unsigned long) v;
+    }
+    *this << v / 1000000000u;
+    number((uint32_t) (v % 1000000000u), false, 9, '0', 10, 1);
+    return *this;
+}
+
+Format &Format::operator<<(const FormatPad &p) {
+    int32_t v = p.value;
+    uint32_t magnitude = v < 0 ? 0u - (uint32_t) v : (uint32_t) v;
+    number(magnitude, v < 0, p.width, p.fill, 10, 1);
+    return *this;
+}
+
+Format &Format::operator<<(const FormatFixed &f) {
+    int decimals = f.decimals < 0 ? 0 : f.decimals > 9 ? 9 : f.decimals;
+    int32_t v = f.value;
+    uint32_t magnitude = v < 0 ? 0u - (uint32_t) v : (uint32_t) v;
+    uint32_t scale = powers_of_ten[decimals];
+    int width = f.width - (decimals > 0 ? decimals + 1 : 0);
+    number(magnitude / scale, v < 0, width, ' ', 10, 1);
+    if (decimals > 0) {
+        put('.');
+        number(magnitude % scale, false, 0, ' ', 10, decimals);
+    }
+    return *this;
+}
+
+Format &Format::operator<<(const FormatHex &h) {
+    number(h.value, false, h.width, '0', 16, 1);
+    return *this;
+}
+
+const char *Format::c_str() const {
+    return buffer;
+}
+
+int Format::length() const {
+    return used;
+}
+
+bool Format::truncated() const {
+    return overflow;
+}
+
+void Format::clear() {
+    used = 0;
+    overflow = false;
+    buffer[0] = '\0';
+}
+
+void Format::put(char c) {
+    if (used + 1 < size) {
+        buffer[used++] = c;
+        buffer[used] = '\0';
+    } else {
+        overflow = true;
+    }
+}
+
+// Digits of magnitude, at least min_digits of them, after the sign and
+// right aligned in width
+void Format::number(uint32_t magnitude, bool negative, int width, char fill,
+        int base, int min_digits) {
+    char digits[32];
+    int n = 0;
+    do {
+        digits[n++] = digit_chars[magnitude % base];
+        magnitude /= base;
+    } while (magnitude > 0 && n < (int) sizeof(digits));
+    while (n < min_digits && n < (int) sizeof(digits)) {
+        digits[n++] = '0';
+    }
+    int length = n + (negative ? 1 : 0);
+    // Zero fill goes between the sign and the digits, as with "%05d"
+    if (negative && fill == '0') {
+        put('-');
+    }
+    for (int i = length; i < width; i++) {
+        put(fill);
+    }
+    if (negative && fill != '0') {
+        put('-');
+    }
+    while (n > 0) {
+        put(digits[--n]);
+    }
+}
@@ -0,0 +1,102 @@
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <stdint.h>
+
+// Text formatting without printf: no format string to parse at run time,
+// no varargs, no float and no heap. Output goes into a fixed buffer that
+// is always terminated; what does not fit is dropped and flagged.
+//
+//   FormatLine f;
+//   f << "AP: cv - " << cv << " | t - " << t;
+//   lcd_line << fixed(bpm_x10, 1, 5) << " BPM";
+//
+// Numbers are 32-bit integers; fractions are fixed point.
+
+// Line sized buffer for console, LCD and log output
+#define FORMAT_LINE 96
+
+// Integer right aligned in width, filled with fill ("%5d", "%03d")
+struct FormatPad {
+    int32_t value;
+    int width;
+    char fill;
+};
+
+// value / 10^decimals with that many decimals ("%.1f" of a tenths count),
+// right aligned in width
+struct FormatFixed {
+    int32_t value;
+    int decimals;
+    int width;
+};
+
+struct FormatHex {
+    uint32_t value;
+    int width;
+};
+
+inline FormatPad pad(int32_t value, int width, char fill = ' ') {
+    FormatPad p = { value, width, fill };
+    return p;
+}
+
+inline FormatFixed fixed(int32_t value, int decimals, int width = 0) {
+    FormatFixed f = { value, decimals, width };
+    return f;
+}
+
+inline FormatHex hex(uint32_t value, int width = 0) {
+    FormatHex h = { value, width };
+    return h;
+}
+
+class Format {
+    public:
+    
+    // size includes the terminator
+    Format(char *_buffer, int _size);
+    
+    Format &operator<<(const char *s);
+    Format &operator<<(char c);
+    Format &operator<<(int v);
+    Format &operator<<(unsigned v);
+    Format &operator<<(long v);
+    Format &operator<<(unsigned long v);
+    Format &operator<<(unsigned long long v);
+    Format &operator<<(const FormatPad &p);
+    Format &operator<<(const FormatFixed &f);
+    Format &operator<<(const FormatHex &h);
+    
+    const char *c_str() const;
+    int length() const;
+    // Some output did not fit
+    bool truncated() const;
+    void clear();
+    
+    private:
+    char *buffer;
+    int size;
+    int used;
+    bool overflow;
+    
+    // Owns no storage, so a copy would alias the original's buffer
+    Format(const Format &);
+    Format &operator=(const Format &);
+    
+    void put(char c);
+    void number(uint32_t magnitude, bool negative, int width, char fill,
+        int base, int min_digits);
+};
+
+template <int N> class FormatBuffer : public Format {
+    public:
+    FormatBuffer() : Format(storage, N) {}
+    
+    private:
+    char storage[N];
+};
+
+typedef FormatBuffer<FORMAT_LINE> FormatLine;
+
+#endif
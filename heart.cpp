@@ -1,24 +1,37 @@
 #include "mbed.h"
 #include "TextLCD.h"
 #include "rtos.h"
-#include "keyboard.h"
+#include "signals.h"
+#include "leds.h"
+#include "display.h"
+#include "console.h"
+#include "stacks.h"
 #include "logger.h"
+#include "localfs.h"
+#include "logstore.h"
+#include "spinor.h"
+#include "pulse.h"
+#include "rhythm.h"
+#include "stress.h"
+#include "margin.h"
+#include "recorder.h"
+#include "telemetry.h"
+#include "format.h"
+#include "profile.h"
 #include <stdlib.h>
 #include <algorithm>
 
-#define AP          0x0001
-#define AS          0x0002
-#define VP          0x0004
-#define VS          0x0008
 #define TO_RANDOM   0x0010
 #define TO_MANUAL   0x0020
 #define TO_TEST     0x0040
 #define MANUAL_AS   0x0080
 #define MANUAL_VS   0x0100
-#define INPUT_READY 0x0200
-#define INTERVAL_CHANGE 0x0400
 #define TO_DYNAMIC  0x0800
 #define TO_EXTENDED 0x1000
+#define TO_REPLAY   0x4000
+#define MODE_INPUT  0x8000
+// Only ever sent to the heart thread, MODE_INPUT only to mode_switch
+#define TO_STRESS   0x8000
 
 #define AVI_max 100
 #define AVI_min 30
@@ -29,30 +42,45 @@
 
 // Values taken from
 // https://www.bostonscientific.com/content/dam/bostonscientific/quality/education-resources/english/ACL_AVSH_20091130.pdf
-#define AV_INCREASE 1.3
+#define AV_INCREASE_X10 13 // 1.3, in tenths
 #define DYNAMIC_AV_MIN 80
 #define DYNAMIC_AV_MAX 150
 
+#define CONSOLE_BAUD 115200
+
+// Rhythm generation in RANDOM mode
+#define RHYTHM_BATCH 16
+#define RHYTHM_SEED 1
+
 #define AP_PIN p5
 #define AS_PIN p6
 #define VP_PIN p7
 #define VS_PIN p8
 
+// Thread stacks in bytes, trimmed from the 'w' watermark report
+#define LOG_STACK 2048
+#define TRACE_STACK 1024
+#define LED_STACK 512
+#define DISPLAY_STACK 1024
+#define INPUT_STACK 1024
+#define MODE_SWITCH_STACK 512
+#define HEART_STACK 2048
+
 // Define the LCD output for this code
 TextLCD lcd(p15, p16, p17, p18, p19, p20, TextLCD::LCD16x2);
 // Keyboard Input
 Serial pc(USBTX, USBRX);
-DigitalOut ap_led(LED1);
-DigitalOut as_led(LED2);
-DigitalOut vp_led(LED3);
-DigitalOut vs_led(LED4);
+Keyboard console_keyboard(&pc);
+// Log flash, used instead of /local when fitted
+SpiNor log_flash(SPINOR_MOSI, SPINOR_MISO, SPINOR_SCK, SPINOR_CS);
+LogStore log_store(&log_flash);
 // Communication
-DigitalOut as_out(AS_PIN);
-DigitalOut vs_out(VS_PIN);
+Pulse as_out(AS_PIN);
+Pulse vs_out(VS_PIN);
 InterruptIn ap_interrupt(AP_PIN);
 InterruptIn vp_interrupt(VP_PIN);
 
-enum Heartmode { RANDOM, MANUAL, TEST, DYNAMIC_TEST, EXTENDED_TEST };
+enum Heartmode { RANDOM, MANUAL, TEST, DYNAMIC_TEST, EXTENDED_TEST, REPLAY, STRESS };
 Heartmode heart_mode = RANDOM;
 
 bool mode_switch_input = false;
@@ -60,12 +88,17 @@ bool manual_signal_input = false;
 char user_input = '~';
 char last_keyboard = ' ';
 
-Thread * led_addr;
-Thread * display_addr;
 Thread * heart_addr;
 Thread * log_addr;
-Thread * keyboard_addr;
-Keyboard * keyboard;
+Thread * mode_switch_addr;
+
+THREAD_STACK(log_stack, LOG_STACK);
+THREAD_STACK(trace_stack, TRACE_STACK);
+THREAD_STACK(led_stack, LED_STACK);
+THREAD_STACK(display_stack, DISPLAY_STACK);
+THREAD_STACK(input_stack, INPUT_STACK);
+THREAD_STACK(mode_switch_stack, MODE_SWITCH_STACK);
+THREAD_STACK(heart_stack, HEART_STACK);
 
 Timer cA;
 Timer cV;
@@ -73,9 +106,64 @@ Timer t_global;
 
 bool running = true;
 
-int observation_interval = 10000;
+Rhythm rhythm;
+// Set with 'p'; RANDOM mode picks it up at its next beat
+volatile RhythmProfile next_profile = RHYTHM_RANDOM;
+
+// Trace number to play back in REPLAY mode
+int replay_no = 0;
+
+// Edge storm in STRESS mode, emitted from stress_timeout so the rate is
+// not bound by the heart thread's millisecond waits
+Stress stress;
+StressPattern stress_pattern = STRESS_BURST;
+int stress_rate_max = STRESS_RATE_MAX;
+Timeout stress_timeout;
+StressEdge stress_pending;
+volatile bool stress_running = false;
+volatile uint32_t stress_edges[2];
+// Edges fired while the last one on the same lead was still high
+volatile uint32_t stress_overlaps = 0;
+
+// Binary telemetry on the serial link, toggled with 'b'
+bool telemetry = false;
+TelemetryTx telemetry_tx;
+Mutex link_mutex;
+int verdicts = 0;
+
+// Assertion margins of the conformance tests, 'i' to list
+Margins margins;
+
+void send_frame(uint8_t type, const uint8_t *payload, int n) {
+    uint8_t frame[TELEMETRY_MAX_FRAME];
+    link_mutex.lock();
+    int len = telemetry_tx.frame(type, payload, n, frame);
+    for (int i = 0; i < len; i++) {
+        pc.putc(frame[i]);
+    }
+    link_mutex.unlock();
+}
+
+// Console output, carried in CONSOLE frames while telemetry is on
+void link_output(const char *s, int n) {
+    if (telemetry) {
+        for (int i = 0; i < n; i += TELEMETRY_MAX_PAYLOAD) {
+            send_frame(FRAME_CONSOLE, (const uint8_t *) s + i,
+                min(n - i, TELEMETRY_MAX_PAYLOAD));
+        }
+    } else {
+        link_mutex.lock();
+        for (int i = 0; i < n; i++) {
+            pc.putc(s[i]);
+        }
+        link_mutex.unlock();
+    }
+}
 
 void a_pace() {
+    PROFILE_SCOPE("a_pace");
+    Recorder::record(TRACE_AP, 1);
+    console_event(AP);
     led_addr->signal_set(AP);
     log_addr->signal_set(AP);
     if (heart_mode == TEST || heart_mode == DYNAMIC_TEST || heart_mode == EXTENDED_TEST) {
@@ -84,6 +172,9 @@ void a_pace() {
 }
 
 void v_pace() {
+    PROFILE_SCOPE("v_pace");
+    Recorder::record(TRACE_VP, 1);
+    console_event(VP);
     led_addr->signal_set(VP);
     display_addr->signal_set(VP);
     log_addr->signal_set(VP);
@@ -92,28 +183,170 @@ void v_pace() {
     }
 }
 
-void set_observation_interval() {
-    int i = 1;
-    int interval = 0;
-    while (keyboard->command[i] != '~') {
-        interval = interval * 10 + (keyboard->command[i] - '0');
-        i ++;
+void a_pace_end() {
+    Recorder::record(TRACE_AP, 0);
+}
+
+void v_pace_end() {
+    Recorder::record(TRACE_VP, 0);
+}
+
+void a_sense_end() {
+    Recorder::record(TRACE_AS, 0);
+}
+
+void v_sense_end() {
+    Recorder::record(TRACE_VS, 0);
+}
+
+void set_rhythm_profile() {
+    int profile = keyboard->read_number(1);
+    if (keyboard->command[1] == '~' || profile >= RHYTHM_COUNT) {
+        for (int p = 0; p < RHYTHM_COUNT; p++) {
+            console_print(FormatLine() << "\n\rp" << p << " - " << rhythm_name[p]);
+        }
+        return;
+    }
+    next_profile = (RhythmProfile) profile;
+    console_print(FormatLine() << "\n\rRhythm profile set to: " << rhythm_name[profile]);
+}
+
+void set_replay() {
+    replay_no = keyboard->read_number(1);
+    heart_addr->signal_set(TO_REPLAY);
+    console_print(FormatLine() << "\n\rReplaying trace " << pad(replay_no, 3, '0'));
+}
+
+// g lists the stress patterns, g<n>[-<max rate>] ramps one up
+void set_stress() {
+    int pattern = keyboard->read_number(1);
+    if (keyboard->command[1] == '~' || pattern >= STRESS_COUNT) {
+        for (int p = 0; p < STRESS_COUNT; p++) {
+            console_print(FormatLine() << "\n\rg" << p << " - " << stress_name[p]);
+        }
+        return;
+    }
+    stress_rate_max = STRESS_RATE_MAX;
+    for (int i = 2; i < 19; i++) {
+        if (keyboard->command[i] == '-') {
+            stress_rate_max = keyboard->read_number(i + 1);
+            break;
+        }
+    }
+    stress_pattern = (StressPattern) pattern;
+    heart_addr->signal_set(TO_STRESS);
+    console_print(FormatLine() << "\n\rStress " << stress_name[pattern]
+        << " up to " << stress_rate_max << "/s");
+}
+
+const char *signal_name(int signal) {
+    return signal == AP ? "AP" : signal == AS ? "AS" : signal == VP ? "VP" :
+        signal == VS ? "VS" : signal == 0 ? "-" : "?";
+}
+
+// i lists the test assertion margins in ms, ic writes them as CSV in us,
+// ir clears them
+void margin_command() {
+    char c = keyboard->command[1];
+    if (c == 'r') {
+        margins.reset();
+        console_print("\n\rMargins cleared");
+        return;
+    }
+    if (c == 'c') {
+        console_print("\n\rmode,test,step,signal,runs,failures,measured,"
+            "min_us,mean_us,p99_us,max_us,last_us,window_us,observed_us");
+    } else {
+        console_print("\n\rmode assert sig runs fail     min    mean     p99    last");
+    }
+    for (int i = 0; i < margins.count; i++) {
+        const MarginStats *s = &margins.stats[i];
+        bool any = s->measured > 0;
+        int32_t mean = any ? (int32_t) (s->sum_us / (int64_t) s->measured) : 0;
+        int32_t p99 = Margins::percentile(s, 99);
+        FormatLine line;
+        line << "\n\r";
+        if (c == 'c') {
+            line << s->mode << ',' << (s->test + 1) << ',' << (s->step + 1) << ','
+                << signal_name(s->signal) << ',' << s->runs << ',' << s->failures
+                << ',' << s->measured << ',';
+            if (any) {
+                line << s->min_us << ',' << mean << ',' << p99 << ',' << s->max_us;
+            } else {
+                line << ",,,";
+            }
+            line << ',';
+            if (s->last_us != MARGIN_NONE) line << s->last_us;
+            line << ',' << s->window_us << ',' << s->observed_us;
+        } else {
+            line << pad(s->mode, 4) << ' ' << pad(s->test + 1, 3) << '.'
+                << pad(s->step + 1, 2, '0') << ' ';
+            line << signal_name(s->signal) << (s->signal ? " " : "  ")
+                << pad(s->runs, 5) << ' ' << pad(s->failures, 4);
+            if (any) {
+                line << ' ' << fixed(s->min_us / 100, 1, 7) << ' '
+                    << fixed(mean / 100, 1, 7) << ' ' << fixed(p99 / 100, 1, 7);
+            } else {
+                line << "       -       -       -";
+            }
+            if (s->last_us != MARGIN_NONE) {
+                line << ' ' << fixed(s->last_us / 100, 1, 7);
+            } else {
+                line << "       -";
+            }
+        }
+        console_print(line);
+    }
+}
+
+void list_stacks() {
+    console_print("\n\rStack peak/size");
+    for (int i = 0; i < stack_count(); i++) {
+        console_print(FormatLine() << "\n\r" << stack_name(i) << ' ' << stack_peak(i) << '/' << stack_size(i));
+    }
+}
+
+// f lists the profile, ff writes it as folded stacks, fr clears it
+void profile_command() {
+    char c = keyboard->command[1];
+    if (c == 'r') {
+        profile_reset();
+        console_print("\n\rProfile cleared");
+    } else {
+        profile_dump(console_output, c == 'f');
     }
-    observation_interval = interval;
-    display_addr->signal_set(INTERVAL_CHANGE);
 }
 
 void interpret_command() {
     if(keyboard->command[0] == 'o') {
-        set_observation_interval();
-        pc.printf("\n\rObservation interval set to: %d", observation_interval);
+        set_observation_interval(keyboard->read_number(1));
+        console_print(FormatLine() << "\n\rObservation interval set to: " << observation_interval);
+        keyboard_addr->signal_set(INPUT_READY);
+    } else if(keyboard->command[0] == 'p') {
+        set_rhythm_profile();
+        keyboard_addr->signal_set(INPUT_READY);
+    } else if(keyboard->command[0] == 'y') {
+        set_replay();
+        keyboard_addr->signal_set(INPUT_READY);
+    } else if(keyboard->command[0] == 'g') {
+        set_stress();
+        keyboard_addr->signal_set(INPUT_READY);
+    } else if(keyboard->command[0] == 'i') {
+        margin_command();
+        keyboard_addr->signal_set(INPUT_READY);
+    } else if(keyboard->command[0] == 'w') {
+        list_stacks();
+        keyboard_addr->signal_set(INPUT_READY);
+    } else if(keyboard->command[0] == 'f') {
+        profile_command();
         keyboard_addr->signal_set(INPUT_READY);
     } else if (Keyboard::my_strequal(keyboard->command,"help",4)) {
-        pc.printf("THIS IS HELP");
+        console_print("THIS IS HELP");
         keyboard_addr->signal_set(INPUT_READY);
     } else {
         user_input = keyboard->command[0];
         mode_switch_input = true;
+        mode_switch_addr->signal_set(MODE_INPUT);
         if (heart_mode == MANUAL && user_input == 'v') {
             heart_addr->signal_set(MANUAL_VS);
         } else if (heart_mode == MANUAL && user_input == 'a') {
@@ -122,28 +355,9 @@ void interpret_command() {
     }
 }
 
-void input_thread(void const * args) {
-    keyboard->prompt();
-    keyboard->reset_command();
-    while(1) {
-        keyboard->last_keyboard = pc.getc();
-        keyboard->read_char(keyboard->last_keyboard);
-        
-        if (keyboard->last_keyboard != '\r') {
-            pc.putc(keyboard->last_keyboard);
-        }
-        
-        if (keyboard->last_keyboard == '\r' || keyboard->command_complete()) {
-            interpret_command();
-            keyboard->reset_command();
-            Thread::signal_wait(0x00);
-            keyboard->prompt();
-        }
-    }
-}
-
 void mode_switch_thread(void const * args) {
     while(1) {
+        Thread::signal_wait(MODE_INPUT);
         if (mode_switch_input) {
             if (user_input != 't' && user_input != 'T' &&
                 user_input != 'd' && user_input != 'D' &&
@@ -160,9 +374,14 @@ void mode_switch_thread(void const * args) {
                 heart_addr->signal_set(TO_DYNAMIC);
             } else if (user_input == 'x' || user_input == 'X') {
                 heart_addr->signal_set(TO_EXTENDED);
+            } else if (user_input == 'b' || user_input == 'B') {
+                telemetry = !telemetry;
+                // No echo or prompt in telemetry mode, the host tool drives input
+                console_quiet = telemetry;
             } else if (user_input == 'q' || user_input == 'Q') {
                 running = false;
-                Logger::close_log_file();\
+                Logger::close_log_file();
+                Recorder::close_trace_file();
             }
             mode_switch_input = false;
         }    
@@ -182,12 +401,35 @@ void wait_v() {
     }
 }
 
+void send_margin(const MarginStats *s) {
+    uint8_t payload[17];
+    payload[0] = s->mode;
+    payload[1] = s->test;
+    payload[2] = s->step;
+    payload[3] = s->signal;
+    payload[4] = s->observed_us >= 0;
+    put_u32(payload + 5, s->window_us);
+    put_u32(payload + 9, s->observed_us);
+    put_u32(payload + 13, s->last_us);
+    send_frame(FRAME_MARGIN, payload, sizeof(payload));
+}
+
+// Test case.step of an assertion, from 1 as the console shows them
+void margin_name(Format &f, const MarginStats *s) {
+    f << (s->test + 1) << '.' << (s->step + 1);
+}
+
 bool wait_assert(int signal, int timeout) {
     osEvent sig;
     int signum = 0;
+    uint32_t start = us_ticker_read();
     if (timeout > 0) sig = Thread::signal_wait(0x00, timeout);
 	else sig = Thread::signal_wait(0x00);
     signum = sig.value.signals;
+    int32_t elapsed = us_ticker_read() - start;
+    // Only the bookkeeping here: the next stimulus may be due within a few
+    // milliseconds, so the margins are reported once the case is over
+    margins.add(signal, timeout > 0 ? timeout * 1000 : 0, signum, elapsed);
     return signum == signal;
 }
 
@@ -203,40 +445,210 @@ void wait_for(int signal) {
 void send_AS() {
     log_addr->signal_set(AS);
     led_addr->signal_set(AS);
-    as_out = 1;
-    Thread::wait(5);
-    as_out = 0;
+    Recorder::record(TRACE_AS, 1);
+    as_out.fire();
+    console_event(AS);
 }
 
 void send_VS() {
     log_addr->signal_set(VS);
     led_addr->signal_set(VS);
-    vs_out = 1;
-    Thread::wait(5);
-    vs_out = 0;
+    Recorder::record(TRACE_VS, 1);
+    vs_out.fire();
+    console_event(VS);
+}
+
+// Play the AS/VS rising edges of /local/trcNNN.bin at their recorded
+// spacing. Returns early, re-raising the signal, on a mode change.
+void replay_trace() {
+    FormatBuffer<32> filename;
+    filename << "/local/trc" << pad(replay_no, 3, '0') << ".bin";
+    FILE *fp = fopen(filename.c_str(), "rb");
+    if (fp == NULL) {
+        console_print(FormatLine() << "\n\rNo trace " << filename.c_str() << "\n\r");
+        return;
+    }
+    TraceHeader header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        header.magic != TRACE_MAGIC) {
+        console_print(FormatLine() << "\n\rNot a trace: " << filename.c_str() << "\n\r");
+        fclose(fp);
+        return;
+    }
+    fseek(fp, header.header_size, SEEK_SET);
+    Logger::log("Replay started");
+    
+    TraceRecord records[32];
+    bool started = false;
+    uint64_t first = 0;
+    uint64_t start = 0;
+    int n;
+    while ((n = fread(records, sizeof(TraceRecord), 32, fp)) > 0) {
+        for (int i = 0; i < n; i++) {
+            int pin = trace_pin(records[i]);
+            if (trace_level(records[i]) != 1 ||
+                (pin != TRACE_AS && pin != TRACE_VS)) {
+                continue;
+            }
+            if (!started) {
+                first = trace_time(records[i]);
+                start = Recorder::now_us();
+                started = true;
+            }
+            uint64_t due = start + (trace_time(records[i]) - first);
+            uint64_t now = Recorder::now_us();
+            if (due > now + 1000) {
+                osEvent sig = Thread::signal_wait(0x00, (due - now) / 1000);
+                int signum = sig.value.signals;
+                if (signum & (TO_RANDOM | TO_MANUAL | TO_TEST | TO_DYNAMIC |
+                        TO_EXTENDED | TO_REPLAY | TO_STRESS)) {
+                    heart_addr->signal_set(signum);
+                    fclose(fp);
+                    Logger::log("Replay stopped");
+                    return;
+                }
+            }
+            if (pin == TRACE_AS) {
+                send_AS();
+            } else {
+                send_VS();
+                display_addr->signal_set(VS);
+            }
+        }
+    }
+    fclose(fp);
+    Logger::log("Replay finished");
+    console_print("Replay complete!\n");
+}
+
+// Raises the pending edge and schedules the next. The senses bypass the
+// LED and log threads, which could not keep up; the trace has them all.
+void stress_edge() {
+    if (!stress_running) return;
+    int chamber = stress_pending.chamber;
+    Pulse *out = chamber == RHYTHM_A ? &as_out : &vs_out;
+    if (out->busy()) stress_overlaps++;
+    out->set_width(stress_pending.width_us);
+    Recorder::record(chamber == RHYTHM_A ? TRACE_AS : TRACE_VS, 1);
+    out->fire();
+    stress_edges[chamber]++;
+    stress_pending = stress.next();
+    stress_timeout.attach_us(&stress_edge, stress_pending.gap_us);
+}
+
+// Ramp stress_pattern from STRESS_RATE_MIN to stress_rate_max, reporting
+// the edges sent in each step. Returns early, re-raising the signal, on a
+// mode change.
+void stress_run() {
+    stress.start(stress_pattern, STRESS_RATE_MIN, stress_rate_max,
+        STRESS_STEP_MS, RHYTHM_SEED);
+    stress_edges[RHYTHM_A] = 0;
+    stress_edges[RHYTHM_V] = 0;
+    stress_overlaps = 0;
+    Logger::log(FormatLine() << "Stress " << stress_name[stress_pattern] << " started");
+    stress_pending = stress.next();
+    stress_running = true;
+    stress_timeout.attach_us(&stress_edge, stress_pending.gap_us);
+    
+    uint32_t last_a = 0;
+    uint32_t last_v = 0;
+    uint32_t last_overlaps = 0;
+    bool stopped = false;
+    for (int rate = stress.rate_min; !stopped; rate = min(rate * 2, stress.rate_max)) {
+        osEvent sig = Thread::signal_wait(0x00, stress.step_ms);
+        int signum = sig.value.signals;
+        if (signum & (TO_RANDOM | TO_MANUAL | TO_TEST | TO_DYNAMIC |
+                TO_EXTENDED | TO_REPLAY | TO_STRESS)) {
+            heart_addr->signal_set(signum);
+            stopped = true;
+        }
+        uint32_t a = stress_edges[RHYTHM_A];
+        uint32_t v = stress_edges[RHYTHM_V];
+        uint32_t overlaps = stress_overlaps;
+        FormatLine line;
+        line << "Stress " << rate << "/s: " << (a - last_a) << " AS "
+            << (v - last_v) << " VS " << (overlaps - last_overlaps) << " overlapped";
+        console_print(FormatLine() << "\n\r" << line.c_str());
+        Logger::log(line);
+        last_a = a;
+        last_v = v;
+        last_overlaps = overlaps;
+        if (rate == stress.rate_max) break;
+    }
+    stress_running = false;
+    stress_timeout.detach();
+    as_out.set_width(PULSE_WIDTH_US);
+    vs_out.set_width(PULSE_WIDTH_US);
+    Logger::log(stopped ? "Stress stopped" : "Stress finished");
+    console_print("\n\rStress complete!\n\r");
+}
+
+// Margins of the case just finished, to the log, telemetry and, when
+// close to failing, the console
+void report_margins() {
+    FormatLine line;
+    for (int i = 0; i < margins.count; i++) {
+        const MarginStats *s = &margins.stats[i];
+        if (!margins.in_case(s)) continue;
+        if (telemetry) send_margin(s);
+        line.clear();
+        line << "Assert ";
+        margin_name(line, s);
+        line << " window " << s->window_us << " observed " << s->observed_us;
+        if (s->last_us != MARGIN_NONE) line << " margin " << s->last_us;
+        Logger::log(line);
+        if (s->passed && s->last_us != MARGIN_NONE &&
+                s->last_us < MARGIN_WARN_US) {
+            line.clear();
+            line << "\n\rAssert ";
+            margin_name(line, s);
+            line << " passed with " << fixed(s->last_us / 100, 1) << "ms to spare";
+            console_print(line);
+        }
+    }
 }
 
 void report(bool assert) {
+    report_margins();
+    margins.next_case();
+    if (telemetry) {
+        uint8_t payload[4];
+        payload[0] = assert;
+        payload[1] = heart_mode;
+        put_u16(payload + 2, ++verdicts);
+        send_frame(FRAME_VERDICT, payload, sizeof(payload));
+    }
     if (!assert) {
         Logger::log("Test failed!");
-        pc.printf("\n\rTest failed!\n\r");
+        console_print("\n\rTest failed!\n\r");
     } else {
         Logger::log("Test passed!");
-        pc.printf("\n\rTest passed!\n\r");
+        console_print("\n\rTest passed!\n\r");
     }
 }
 
 int update_AVI(int ms) {
     return max(DYNAMIC_AV_MIN,
-        min(DYNAMIC_AV_MAX, (int) (AV_INCREASE * ms)));
+        min(DYNAMIC_AV_MAX, ms * AV_INCREASE_X10 / 10));
 }
 
 void heart_thread(void const * args) {
+    Beat beats[RHYTHM_BATCH];
+    int beat_index = RHYTHM_BATCH;
+    rhythm.reset(next_profile, RHYTHM_SEED);
     while (true) {
         if (heart_mode == RANDOM) {
-            int target;
-            int next = rand() % 3000;
-            osEvent sig = Thread::signal_wait(0x00, next);
+            // No signal for a new profile, so neither MANUAL nor a test
+            // ever sees one; it is applied here
+            if (rhythm.profile != next_profile) {
+                rhythm.reset(next_profile, RHYTHM_SEED);
+                beat_index = RHYTHM_BATCH;
+            }
+            if (beat_index == RHYTHM_BATCH) {
+                rhythm.fill(beats, RHYTHM_BATCH);
+                beat_index = 0;
+            }
+            osEvent sig = Thread::signal_wait(0x00, beats[beat_index].interval);
             int signum = sig.value.signals;
             if (signum & TO_MANUAL) {
                 heart_mode = MANUAL;
@@ -246,9 +658,12 @@ void heart_thread(void const * args) {
                 heart_mode = DYNAMIC_TEST;
             } else if (signum & TO_EXTENDED) {
                 heart_mode = EXTENDED_TEST;
+            } else if (signum & TO_REPLAY) {
+                heart_mode = REPLAY;
+            } else if (signum & TO_STRESS) {
+                heart_mode = STRESS;
             } else {
-                target = rand() % 2;
-                if (target) {
+                if (beats[beat_index++].chamber == RHYTHM_A) {
                     send_AS();
                 } else {
                     send_VS();
@@ -266,19 +681,30 @@ void heart_thread(void const * args) {
                 heart_mode = DYNAMIC_TEST;
             } else if (signum & TO_EXTENDED) {
                 heart_mode = EXTENDED_TEST;
+            } else if (signum & TO_REPLAY) {
+                heart_mode = REPLAY;
+            } else if (signum & TO_STRESS) {
+                heart_mode = STRESS;
             } else if (signum & MANUAL_VS) {
                 send_VS();
             } else if (signum & MANUAL_AS) {
                 send_AS();
             }
+        } else if (heart_mode == REPLAY) {
+            replay_trace();
+            heart_mode = RANDOM;
+        } else if (heart_mode == STRESS) {
+            stress_run();
+            heart_mode = RANDOM;
         } else if (heart_mode == TEST) {
             bool assert = true;
             int interval = 15;
             // Initialize test cases
+            margins.begin(heart_mode);
             cA.start();
             cV.start();
             Logger::log("Test started");
-            pc.printf("\n\rTest started!\n\r");
+            console_print("\n\rTest started!\n\r");
             
             // Test normal operation
             wait_for(AP);
@@ -375,17 +801,18 @@ void heart_thread(void const * args) {
             cV.stop();
             cA.reset();
             cV.reset();
-            pc.puts("Tests complete!\n");
+            console_print("Tests complete!\n");
             keyboard_addr->signal_set(INPUT_READY);
             heart_mode = RANDOM;
         } else if (heart_mode == DYNAMIC_TEST) {
             bool assert = true;
             int interval = 15;
             // Initialize test cases
+            margins.begin(heart_mode);
             cA.start();
             cV.start();
             Logger::log("Dynamic Test started");
-            pc.printf("\n\rDynamic Test started!\n\r");
+            console_print("\n\rDynamic Test started!\n\r");
             
             // Test normal operation
             wait_for(AP);
@@ -495,17 +922,18 @@ void heart_thread(void const * args) {
             cV.stop();
             cA.reset();
             cV.reset();
-            pc.puts("Tests complete!\n");
+            console_print("Tests complete!\n");
             keyboard_addr->signal_set(INPUT_READY);
             heart_mode = RANDOM;
         } else if (heart_mode == EXTENDED_TEST) {
             bool assert = true;
             int interval = 15;
             // Initialize test cases
+            margins.begin(heart_mode);
             cA.start();
             cV.start();
             Logger::log("Extended Test started");
-            pc.printf("\n\rExtended Test started!\n\r");
+            console_print("\n\rExtended Test started!\n\r");
             
             // Test one VS too soon, AS too soon
             wait_for(AP);
@@ -545,116 +973,130 @@ void heart_thread(void const * args) {
             cV.stop();
             cA.reset();
             cV.reset();
-            pc.puts("Tests complete!\n");
+            console_print("Tests complete!\n");
             keyboard_addr->signal_set(INPUT_READY);
             heart_mode = RANDOM;
         }
     }
 }
 
-void led_thread(void const * args) {
-    while (true) {
-        osEvent sig = Thread::signal_wait(0x00);
-        int signum = sig.value.signals;
-        if (signum & AP) {
-            ap_led = 1;
-            Thread::wait(100);
-            ap_led = 0;
-        } else if (signum & AS) {
-            as_led = 1;
-            Thread::wait(100);
-            as_led = 0;
-        } else if (signum & VP) {
-            vp_led = 1;
-            Thread::wait(100);
-            vp_led = 0;
-        } else if (signum & VS) {
-            vs_led = 1;
-            Thread::wait(100);
-            vs_led = 0;
-        }
+// STATS frame at the end of every observation interval
+void report_rate(int count, int interval) {
+    if (telemetry) {
+        uint8_t payload[8];
+        // Same guard as the display: 'o' with no digits sets 0. Saturated,
+        // as stress mode runs far past what 16 bits of tenths hold.
+        int64_t bpm = interval > 0 ? (int64_t) count * 600000 / interval : 0;
+        put_u16(payload, bpm > 0xFFFF ? 0xFFFF : (uint16_t) bpm);
+        put_u16(payload + 2, count > 0xFFFF ? 0xFFFF : count);
+        put_u32(payload + 4, interval);
+        send_frame(FRAME_STATS, payload, sizeof(payload));
     }
 }
 
-void display_thread(void const * args) {
-    Timer t;
-    int count = 0;
-    lcd.printf("Initialized\n\n");
-    t.reset();
-    t.start();
-    while (true) {
-        osEvent sig = Thread::signal_wait(0x00, max(observation_interval - t.read_ms(), 1));
-        int signum = sig.value.signals;
-        if ((signum & VP) || (signum & VS)) {
-            count++;
-        } else if (signum & INTERVAL_CHANGE) {
-            t.reset();
-            count = 0;
-            lcd.locate(0,0);
-            lcd.printf("Initialized\n\n");
-        } else {
-            double bpm = (double) count * 60000.0 / (double) observation_interval;
-            lcd.locate(0,0);
-            lcd.printf("%f BPM", bpm);
-            count = 0;
-            t.reset();
-        }
+void trace_thread(void const * args) {
+    while (running) {
+        Recorder::flush();
+        Thread::wait(50);
     }
 }
 
+void send_event(int event) {
+    uint8_t payload[5];
+    payload[0] = event;
+    put_u32(payload + 1, t_global.read_ms());
+    send_frame(FRAME_EVENT, payload, sizeof(payload));
+}
+
 void log_thread(void const * args) {
-    char buffer[100];
+    FormatLine line;
     while (running) {
         osEvent sig = Thread::signal_wait(0x00);
+        PROFILE_SCOPE("log_event");
         int signum = sig.value.signals;
         if (signum & AP) {
-            if (heart_mode == TEST || heart_mode == DYNAMIC_TEST || heart_mode == EXTENDED_TEST)
-                pc.printf("\n\rAP: %d", t_global.read_ms());
-            sprintf(buffer, "AP: cv - %d | ca - %d | t - %d",
-                cV.read_ms(), cA.read_ms(), t_global.read_ms());
-            Logger::log(buffer);
+            if (telemetry)
+                send_event(AP);
+            else if (heart_mode == TEST || heart_mode == DYNAMIC_TEST || heart_mode == EXTENDED_TEST)
+                console_print(FormatLine() << "\n\rAP: " << t_global.read_ms());
+            line.clear();
+            line << "AP: cv - " << cV.read_ms() << " | ca - " << cA.read_ms()
+                << " | t - " << t_global.read_ms();
+            Logger::log(line.c_str());
         } else if (signum & VP) {
-            if (heart_mode == TEST || heart_mode == DYNAMIC_TEST || heart_mode == EXTENDED_TEST)
-                pc.printf("\n\rVP: %d", t_global.read_ms());
-            sprintf(buffer, "VP: cv - %d | ca - %d | t - %d",
-                cV.read_ms(), cA.read_ms(), t_global.read_ms());
-            Logger::log(buffer);
+            if (telemetry)
+                send_event(VP);
+            else if (heart_mode == TEST || heart_mode == DYNAMIC_TEST || heart_mode == EXTENDED_TEST)
+                console_print(FormatLine() << "\n\rVP: " << t_global.read_ms());
+            line.clear();
+            line << "VP: cv - " << cV.read_ms() << " | ca - " << cA.read_ms()
+                << " | t - " << t_global.read_ms();
+            Logger::log(line.c_str());
         } else if (signum & AS) {
-            if (heart_mode == TEST || heart_mode == DYNAMIC_TEST || heart_mode == EXTENDED_TEST)
-                pc.printf("\n\rAS: %d", t_global.read_ms());
-            sprintf(buffer, "AS: cv - %d | ca - %d | t - %d",
-                cV.read_ms(), cA.read_ms(), t_global.read_ms());
-            Logger::log(buffer);
+            if (telemetry)
+                send_event(AS);
+            else if (heart_mode == TEST || heart_mode == DYNAMIC_TEST || heart_mode == EXTENDED_TEST)
+                console_print(FormatLine() << "\n\rAS: " << t_global.read_ms());
+            line.clear();
+            line << "AS: cv - " << cV.read_ms() << " | ca - " << cA.read_ms()
+                << " | t - " << t_global.read_ms();
+            Logger::log(line.c_str());
         } else if (signum & VS) {
-            if (heart_mode == TEST || heart_mode == DYNAMIC_TEST || heart_mode == EXTENDED_TEST)
-                pc.printf("\n\rVS: %d", t_global.read_ms());
-            sprintf(buffer, "VS: cv - %d | ca - %d | t - %d",
-                cV.read_ms(), cA.read_ms(), t_global.read_ms());
-            Logger::log(buffer);
+            if (telemetry)
+                send_event(VS);
+            else if (heart_mode == TEST || heart_mode == DYNAMIC_TEST || heart_mode == EXTENDED_TEST)
+                console_print(FormatLine() << "\n\rVS: " << t_global.read_ms());
+            line.clear();
+            line << "VS: cv - " << cV.read_ms() << " | ca - " << cA.read_ms()
+                << " | t - " << t_global.read_ms();
+            Logger::log(line.c_str());
         }
     }
 }
 
 int main() {
+    pc.baud(CONSOLE_BAUD);
+    profile_init();
     t_global.start();
-    Logger::create_log_file("LOG FILE");
-    Thread log(log_thread);
+    console_output = &link_output;
+    if (log_flash.init() && log_store.mount() == 0) {
+        Logger::use_store(&log_store);
+    }
+    Logger::create_log_file("LOG FILE", true);
+    Recorder::create_trace_file(TRACE_BOARD_HEART);
+    Thread log(log_thread, NULL, osPriorityNormal, LOG_STACK,
+        stack_paint("log", log_stack, LOG_STACK));
     log_addr = &log;
+    Thread trace(trace_thread, NULL, osPriorityNormal, TRACE_STACK,
+        stack_paint("trace", trace_stack, TRACE_STACK));
     // Initialize keyboard
-    keyboard = new Keyboard(&pc);
+    console_init(&pc, &console_keyboard, &interpret_command, true);
+    display_report = &report_rate;
     // Assign interrupts
     ap_interrupt.rise(&a_pace);
     vp_interrupt.rise(&v_pace);
+    ap_interrupt.fall(&a_pace_end);
+    vp_interrupt.fall(&v_pace_end);
+    as_out.on_complete(&a_sense_end);
+    vs_out.on_complete(&v_sense_end);
     // Initialize the threads
-    Thread leds(led_thread);
+    Thread leds(led_thread, NULL, osPriorityNormal, LED_STACK,
+        stack_paint("led", led_stack, LED_STACK));
     led_addr = &leds;
-    Thread display(display_thread);
+    Thread display(display_thread, &lcd, osPriorityNormal, DISPLAY_STACK,
+        stack_paint("display", display_stack, DISPLAY_STACK));
     display_addr = &display;
-    Thread keyboard(input_thread);
+    Thread keyboard(input_thread, NULL, osPriorityNormal, INPUT_STACK,
+        stack_paint("input", input_stack, INPUT_STACK));
     keyboard_addr = &keyboard;
-    Thread mode_switch(mode_switch_thread);
-    Thread heart(heart_thread);
+    Thread mode_switch(mode_switch_thread, NULL, osPriorityNormal, MODE_SWITCH_STACK,
+        stack_paint("mode_switch", mode_switch_stack, MODE_SWITCH_STACK));
+    mode_switch_addr = &mode_switch;
+    Thread heart(heart_thread, NULL, osPriorityNormal, HEART_STACK,
+        stack_paint("heart", heart_stack, HEART_STACK));
     heart_addr = &heart;
     
-    while (true) { }
+    while (true) {
+        Thread::wait(osWaitForever);
+    }
 }
\ No newline at end of file
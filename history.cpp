@@ -0,0 +1,157 @@
+#include "history.h"
+#include <string.h>
+
+static const uint32_t level_period[HISTORY_LEVELS] = { 1, 60, 3600 };
+static const int level_length[HISTORY_LEVELS] =
+    { HISTORY_SECONDS, HISTORY_MINUTES, HISTORY_HOURS };
+
+History::History() {
+    reset(0);
+}
+
+void History::reset(uint32_t now) {
+    for (int level = 0; level < HISTORY_LEVELS; level++) {
+        clear(&open[level], now - now % period(level));
+        head[level] = 0;
+        filled[level] = 0;
+    }
+}
+
+void History::atrial(uint32_t now, bool paced) {
+    advance(now);
+    if (paced) {
+        open[0].paced_a++;
+    } else {
+        open[0].sensed_a++;
+    }
+}
+
+void History::ventricular(uint32_t now, bool paced, int interval_ms, int avi_ms) {
+    advance(now);
+    HistoryBucket &b = open[0];
+    if (paced) {
+        b.paced_v++;
+    } else {
+        b.sensed_v++;
+    }
+    if (interval_ms > 0) {
+        int rate = 60000 / interval_ms;
+        b.rate_sum += rate;
+        if (b.rate_count == 0 || rate < b.rate_min) b.rate_min = rate;
+        if (b.rate_count == 0 || rate > b.rate_max) b.rate_max = rate;
+        b.rate_count++;
+    }
+    if (avi_ms >= 0) {
+        b.avi_sum += avi_ms;
+        if (b.avi_count == 0 || avi_ms < b.avi_min) b.avi_min = avi_ms;
+        if (b.avi_count == 0 || avi_ms > b.avi_max) b.avi_max = avi_ms;
+        b.avi_count++;
+    }
+}
+
+void History::alarm(uint32_t now, bool fast) {
+    advance(now);
+    if (fast) {
+        if (open[0].alarms_fast < 0xFF) open[0].alarms_fast++;
+    } else {
+        if (open[0].alarms_slow < 0xFF) open[0].alarms_slow++;
+    }
+}
+
+void History::advance(uint32_t now) {
+    advance_level(0, now);
+}
+
+// Bounded by the ring length however long nothing was recorded: once a
+// gap covers the whole ring, the ring is emptied and the level jumps ahead
+void History::advance_level(int level, uint32_t now) {
+    uint32_t p = period(level);
+    while (now >= open[level].start + p) {
+        uint32_t behind = now - open[level].start;
+        if (empty(open[level]) && behind / p > (uint32_t) length(level)) {
+            uint32_t start = now - now % p;
+            if (level + 1 < HISTORY_LEVELS) {
+                advance_level(level + 1, start);
+            }
+            filled[level] = 0;
+            clear(&open[level], start);
+        } else {
+            close(level);
+        }
+    }
+}
+
+void History::close(int level) {
+    HistoryBucket &b = open[level];
+    ring[offset(level) + head[level]] = b;
+    head[level] = (head[level] + 1) % length(level);
+    if (filled[level] < length(level)) filled[level]++;
+    if (level + 1 < HISTORY_LEVELS) {
+        advance_level(level + 1, b.start);
+        merge(&open[level + 1], b);
+    }
+    clear(&b, b.start + period(level));
+}
+
+uint32_t History::period(int level) {
+    return level_period[level];
+}
+
+int History::count(int level) const {
+    return filled[level];
+}
+
+const HistoryBucket &History::get(int level, int i) const {
+    int oldest = (head[level] - filled[level] + length(level)) % length(level);
+    return ring[offset(level) + (oldest + i) % length(level)];
+}
+
+const HistoryBucket &History::current(int level) const {
+    return open[level];
+}
+
+int History::length(int level) {
+    return level_length[level];
+}
+
+int History::offset(int level) {
+    int offset = 0;
+    for (int i = 0; i < level; i++) {
+        offset += level_length[i];
+    }
+    return offset;
+}
+
+void History::clear(HistoryBucket *b, uint32_t start) {
+    memset(b, 0, sizeof(*b));
+    b->start = start;
+}
+
+void History::merge(HistoryBucket *into, const HistoryBucket &from) {
+    if (from.rate_count > 0) {
+        if (into->rate_count == 0 || from.rate_min < into->rate_min) into->rate_min = from.rate_min;
+        if (into->rate_count == 0 || from.rate_max > into->rate_max) into->rate_max = from.rate_max;
+        into->rate_sum += from.rate_sum;
+        into->rate_count += from.rate_count;
+    }
+    if (from.avi_count > 0) {
+        if (into->avi_count == 0 || from.avi_min < into->avi_min) into->avi_min = from.avi_min;
+        if (into->avi_count == 0 || from.avi_max > into->avi_max) into->avi_max = from.avi_max;
+        into->avi_sum += from.avi_sum;
+        into->avi_count += from.avi_count;
+    }
+    into->paced_a += from.paced_a;
+    into->sensed_a += from.sensed_a;
+    into->paced_v += from.paced_v;
+    into->sensed_v += from.sensed_v;
+    into->alarms_fast = into->alarms_fast + from.alarms_fast > 0xFF ?
+        0xFF : into->alarms_fast + from.alarms_fast;
+    into->alarms_slow = into->alarms_slow + from.alarms_slow > 0xFF ?
+        0xFF : into->alarms_slow + from.alarms_slow;
+}
+
+bool History::empty(const HistoryBucket &b) {
+    return b.rate_count == 0 && b.avi_count == 0 && b.paced_a == 0 &&
+        b.sensed_a == 0 && b.paced_v == 0 && b.sensed_v == 0 &&
+        b.alarms_fast == 0 && b.alarms_slow == 0;
+}
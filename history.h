@@ -0,0 +1,79 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdint.h>
+
+// Bucket widths and how many closed buckets each level keeps: the last
+// minute by seconds, the last hour by minutes, the last two days by hours
+#define HISTORY_LEVELS 3
+#define HISTORY_SECONDS 60
+#define HISTORY_MINUTES 60
+#define HISTORY_HOURS 48
+#define HISTORY_BUCKETS (HISTORY_SECONDS + HISTORY_MINUTES + HISTORY_HOURS)
+
+// Activity in [start, start + period) seconds of uptime
+struct HistoryBucket {
+    uint32_t start;
+    // Ventricular rate in bpm, one sample per V-V interval
+    uint32_t rate_sum;
+    uint16_t rate_count;
+    uint16_t rate_min;
+    uint16_t rate_max;
+    uint16_t paced_a;
+    uint16_t sensed_a;
+    uint16_t paced_v;
+    uint16_t sensed_v;
+    // AV delay in ms, for ventricular events that followed an atrial one
+    uint16_t avi_count;
+    uint32_t avi_sum;
+    uint16_t avi_min;
+    uint16_t avi_max;
+    uint8_t alarms_fast;
+    uint8_t alarms_slow;
+};
+
+// Multi-resolution history in fixed memory. Events land in the open
+// seconds bucket; a closed bucket is kept in its level's ring and folded
+// into the open bucket of the next level, so recording is O(1) and no
+// level ever holds more than its ring. Times are seconds of uptime and
+// must not go backwards. Not thread safe; callers serialize.
+class History {
+    public:
+    History();
+    
+    void reset(uint32_t now);
+    
+    void atrial(uint32_t now, bool paced);
+    // interval_ms since the previous ventricular event, avi_ms since the
+    // atrial event before this one; either may be negative when unknown
+    void ventricular(uint32_t now, bool paced, int interval_ms, int avi_ms);
+    void alarm(uint32_t now, bool fast);
+    
+    // Close every bucket that ended before now
+    void advance(uint32_t now);
+    
+    static uint32_t period(int level);
+    
+    // Closed buckets of a level, oldest first
+    int count(int level) const;
+    const HistoryBucket &get(int level, int i) const;
+    // The bucket still collecting events
+    const HistoryBucket &current(int level) const;
+    
+    private:
+    HistoryBucket ring[HISTORY_BUCKETS];
+    HistoryBucket open[HISTORY_LEVELS];
+    int head[HISTORY_LEVELS];
+    int filled[HISTORY_LEVELS];
+    
+    void advance_level(int level, uint32_t now);
+    void close(int level);
+    
+    static int length(int level);
+    static int offset(int level);
+    static void clear(HistoryBucket *b, uint32_t start);
+    static void merge(HistoryBucket *into, const HistoryBucket &from);
+    static bool empty(const HistoryBucket &b);
+};
+
+#endif
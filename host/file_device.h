@@ -0,0 +1,95 @@
+#ifndef FILE_DEVICE_H
+#define FILE_DEVICE_H
+
+// BlockDevice over an image file, standing in for the log flash on the
+// host. Keeps the NOR rules, so programming only clears bits, and can
+// cut the power after a given number of page programs: that program is
+// left half done and every later call fails, as on a board that lost
+// power mid-write.
+
+#include "blockdev.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+class FileBlockDevice : public BlockDevice {
+    public:
+    
+    // Programs before the power cut, -1 for never
+    long power_cut;
+    long programs;
+    long erases;
+    
+    FileBlockDevice(uint32_t _erase = 4096, uint32_t _page = 256) :
+        power_cut(-1), programs(0), erases(0), fd(-1), bytes(0),
+        sector(_erase), page(_page), dead(false) {}
+    
+    ~FileBlockDevice() {
+        if (fd >= 0) close(fd);
+    }
+    
+    // Open an image; with create, one of size bytes is made, erased, when
+    // the file does not exist. Returns false on failure.
+    bool open_image(const char *path, bool create, uint32_t size) {
+        fd = open(path, create ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) < 0) return false;
+        if (st.st_size == 0 && create) {
+            std::vector<uint8_t> blank(sector, 0xFF);
+            for (uint32_t a = 0; a < size; a += sector) {
+                if (pwrite(fd, blank.data(), sector, a) != (ssize_t) sector) {
+                    return false;
+                }
+            }
+            st.st_size = size;
+        }
+        bytes = st.st_size / sector * sector;
+        return bytes > 0;
+    }
+    
+    virtual int read(uint32_t addr, void *data, uint32_t n) {
+        if (dead || addr + n > bytes) return -1;
+        return pread(fd, data, n, addr) == (ssize_t) n ? 0 : -1;
+    }
+    
+    virtual int program(uint32_t addr, const void *data, uint32_t n) {
+        if (dead || addr % page || n % page || addr + n > bytes) return -1;
+        std::vector<uint8_t> cell(n);
+        if (pread(fd, cell.data(), n, addr) != (ssize_t) n) return -1;
+        uint32_t done = n;
+        if (power_cut >= 0 && programs + (long) (n / page) > power_cut) {
+            done = (uint32_t) (power_cut - programs) * page + page / 2;
+            dead = true;
+        }
+        for (uint32_t i = 0; i < done; i++) {
+            cell[i] &= ((const uint8_t *) data)[i];
+        }
+        programs += n / page;
+        if (pwrite(fd, cell.data(), done, addr) != (ssize_t) done) return -1;
+        return dead ? -1 : 0;
+    }
+    
+    virtual int erase(uint32_t addr, uint32_t n) {
+        if (dead || addr % sector || n % sector || addr + n > bytes) return -1;
+        std::vector<uint8_t> blank(n, 0xFF);
+        erases += n / sector;
+        return pwrite(fd, blank.data(), n, addr) == (ssize_t) n ? 0 : -1;
+    }
+    
+    virtual uint32_t size() { return bytes; }
+    virtual uint32_t erase_size() { return sector; }
+    virtual uint32_t program_size() { return page; }
+    
+    private:
+    int fd;
+    uint32_t bytes;
+    uint32_t sector;
+    uint32_t page;
+    bool dead;
+};
+
+#endif
@@ -0,0 +1,218 @@
+// Population simulator: N virtual hearts, each paired with its own Pacing
+// engine, advanced together one millisecond per tick. All engines share
+// the default parameter set.
+//
+// Build and run from this directory:
+//   g++ -O3 -march=native -std=c++11 -pthread -I.. heart_sim.cpp ../pacing.cpp ../params.cpp ../format.cpp ../rhythm.cpp -o heart_sim
+//   ./heart_sim [patients] [seconds] [seed] [profile|mix]
+//
+// The clocks and deadlines are kept as struct-of-arrays so the update in
+// every tick is a straight loop over int arrays. Rhythm and Pacing stay
+// whole objects, as the code under test uses them, and at 120 bytes a
+// patient they dominate the footprint. Patients are independent, so each
+// worker thread takes a contiguous range and walks it in blocks whose
+// entire state stays in the L1 data cache for the whole run.
+
+#include "pacing.h"
+#include "rhythm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// About 17 KB of patient state, half a typical L1 data cache; a multiple
+// of 64 so no byte array straddles two workers' cache lines
+#define BLOCK 128
+
+struct Counters {
+    long long ap, vp;
+    long long as_seen, as_accepted;
+    long long vs_seen, vs_accepted;
+    
+    Counters() { memset(this, 0, sizeof(*this)); }
+    
+    void add(const Counters &o) {
+        ap += o.ap; vp += o.vp;
+        as_seen += o.as_seen; as_accepted += o.as_accepted;
+        vs_seen += o.vs_seen; vs_accepted += o.vs_accepted;
+    }
+};
+
+struct Population {
+    int n;
+    PaceParams params;
+    // Pacemaker clocks, ms since the last accepted atrial/ventricular event
+    std::vector<int> ca, cv;
+    // ms until the heart beats and until the pacemaker deadline
+    std::vector<int> heart_left, pace_left;
+    // Chamber of the heart's next event
+    std::vector<uint8_t> heart_chamber;
+    // Each patient's rhythm carries its own RNG stream
+    std::vector<Rhythm> rhythm;
+    std::vector<Pacing> engine;
+    
+    // profile < 0 spreads all rhythm profiles across the population
+    Population(int _n, uint64_t seed, int profile) : n(_n), ca(_n), cv(_n),
+        heart_left(_n), pace_left(_n), heart_chamber(_n), rhythm(_n),
+        engine(_n) {
+        params_defaults(&params);
+        for (int i = 0; i < n; i++) {
+            rhythm[i].reset(
+                (RhythmProfile) (profile < 0 ? i % RHYTHM_COUNT : profile),
+                seed + (uint64_t) i * 0x9E3779B97F4A7C15ull);
+            // Automatic modes only, spread across the population
+            engine[i].mode = (Pacemode) (i % 3);
+            // Match the startup skew between cA and cV in pace.cpp
+            ca[i] = rhythm[i].rng.below(70) + 30;
+            cv[i] = 0;
+            schedule(i);
+            pace_left[i] = engine[i].next(params, ca[i], cv[i]);
+        }
+    }
+    
+    void schedule(int i) {
+        Beat b = rhythm[i].next();
+        heart_left[i] = std::max((int) b.interval, 1);
+        heart_chamber[i] = b.chamber;
+    }
+    
+    void beat(int i, Counters &c) {
+        if (heart_chamber[i] == RHYTHM_A) {
+            c.as_seen++;
+            if (engine[i].sense_a(params, ca[i], cv[i])) {
+                ca[i] = 0;
+                c.as_accepted++;
+            }
+        } else {
+            c.vs_seen++;
+            if (engine[i].sense_v(params, ca[i], cv[i])) {
+                cv[i] = 0;
+                c.vs_accepted++;
+            }
+        }
+        schedule(i);
+    }
+    
+    void pace(int i, Counters &c) {
+        if (engine[i].pace(params, ca[i], cv[i]) == PACE_VP) {
+            cv[i] = 0;
+            c.vp++;
+        } else {
+            ca[i] = 0;
+            c.ap++;
+        }
+    }
+    
+    // Advance patients [lo, hi) by one millisecond. Counters are indexed
+    // by pace mode.
+    void tick(int lo, int hi, Counters *c) {
+        int *a = &ca[0], *v = &cv[0];
+        int *h = &heart_left[0], *p = &pace_left[0];
+        int due = 0;
+        for (int i = lo; i < hi; i++) {
+            a[i]++;
+            v[i]++;
+            h[i]--;
+            p[i]--;
+            due |= (h[i] <= 0) | (p[i] <= 0);
+        }
+        if (!due) return;
+        for (int i = lo; i < hi; i++) {
+            if (h[i] > 0 && p[i] > 0) continue;
+            // A sense arriving together with the deadline wins, as in
+            // pace_thread where a pending signal preempts the timeout
+            if (h[i] <= 0) {
+                beat(i, c[engine[i].mode]);
+            } else {
+                pace(i, c[engine[i].mode]);
+            }
+            p[i] = engine[i].next(params, a[i], v[i]);
+        }
+    }
+    
+    void run(int lo, int hi, int ticks, Counters *c) {
+        for (int b = lo; b < hi; b += BLOCK) {
+            int e = std::min(hi, b + BLOCK);
+            for (int t = 0; t < ticks; t++) {
+                tick(b, e, c);
+            }
+        }
+    }
+};
+
+static const char *mode_name[] = { "NORMAL", "SLEEP", "EXERCISE" };
+
+int main(int argc, char **argv) {
+    int patients = argc > 1 ? atoi(argv[1]) : 100000;
+    int seconds = argc > 2 ? atoi(argv[2]) : 60;
+    uint64_t seed = argc > 3 ? strtoull(argv[3], NULL, 0) : 1;
+    int profile = RHYTHM_RANDOM;
+    if (argc > 4) {
+        profile = -2;
+        for (int r = 0; r < RHYTHM_COUNT; r++) {
+            if (strcmp(argv[4], rhythm_name[r]) == 0) profile = r;
+        }
+        if (strcmp(argv[4], "mix") == 0) profile = -1;
+    }
+    if (patients <= 0 || seconds <= 0 || profile < -1) {
+        fprintf(stderr, "usage: %s [patients] [seconds] [seed] [profile|mix]\n",
+            argv[0]);
+        return 1;
+    }
+    
+    Population pop(patients, seed, profile);
+    int workers = std::max(1u, std::thread::hardware_concurrency());
+    workers = std::min(workers, (patients + BLOCK - 1) / BLOCK);
+    
+    // Every worker counts per mode in its own locals and stores them once
+    // it is done, so no counter shares a cache line while running
+    std::vector<Counters> counters(workers * 3);
+    std::vector<std::thread> threads;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    int per_worker = (patients + workers - 1) / workers;
+    // Round ranges to whole blocks so workers never share a cache line
+    per_worker = (per_worker + BLOCK - 1) / BLOCK * BLOCK;
+    for (int w = 0; w < workers; w++) {
+        int lo = std::min(patients, w * per_worker);
+        int hi = std::min(patients, lo + per_worker);
+        threads.push_back(std::thread([&pop, &counters, w, lo, hi, seconds]() {
+            Counters local[3];
+            pop.run(lo, hi, seconds * 1000, local);
+            std::copy(local, local + 3, &counters[w * 3]);
+        }));
+    }
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+    double elapsed = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    
+    printf("patients %d, virtual time %d s, wall time %.3f s, %d threads\n",
+        patients, seconds, elapsed, workers);
+    printf("patient-seconds per second: %.0f\n",
+        (double) patients * seconds / elapsed);
+    Counters total;
+    for (int m = 0; m <= 3; m++) {
+        Counters c;
+        if (m < 3) {
+            for (int w = 0; w < workers; w++) {
+                c.add(counters[w * 3 + m]);
+            }
+            total.add(c);
+        } else {
+            c = total;
+        }
+        long long paced = c.ap + c.vp;
+        long long sensed = c.as_accepted + c.vs_accepted;
+        printf("%-9s AP %lld VP %lld | AS %lld/%lld VS %lld/%lld accepted"
+            " | pacing ratio %.4f\n",
+            m < 3 ? mode_name[m] : "ALL", c.ap, c.vp,
+            c.as_accepted, c.as_seen, c.vs_accepted, c.vs_seen,
+            paced + sensed ? (double) paced / (double) (paced + sensed) : 0.0);
+    }
+    return 0;
+}
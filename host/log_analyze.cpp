@@ -0,0 +1,419 @@
+// Offline analyzer for Logger output (/local/logNNN.txt or .lgz).
+//
+// Build and run from this directory:
+//   g++ -O2 -std=c++11 -pthread -I.. log_analyze.cpp ../logz.cpp -o log_analyze
+//   ./log_analyze [-u uri_ms] [-l lri_ms] [-j threads] log000.txt ... > summary.json
+//
+// Every file is memory-mapped, compressed logs unpacked first with their
+// blocks decoded in parallel, and the text split into chunks at line
+// boundaries.
+// Worker threads scan chunks in parallel with memchr and reduce each one to
+// a compact event list; intervals are then computed per file in order.
+// The summary is written to stdout as JSON, per file and in aggregate.
+
+#include "logz.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define CHUNK_BYTES (8 << 20)
+
+// Interval histograms: V-V and A-A in 10 ms bins up to 4 s, AVI in 5 ms
+// bins up to 400 ms. The last bin collects everything above.
+#define RR_BIN 10
+#define RR_BINS 401
+#define AVI_BIN 5
+#define AVI_BINS 81
+
+// Logged t_global.read_ms() wraps with the 32-bit microsecond timer
+#define T_WRAP_MS 4294967
+
+enum { EV_AP, EV_AS, EV_VP, EV_VS };
+static const char *ev_name[] = { "AP", "AS", "VP", "VS" };
+
+struct Event {
+    int32_t t;
+    uint8_t type;
+};
+
+struct Chunk {
+    int file;
+    const char *begin, *end;
+    std::vector<Event> events;
+    long long passed, failed, lines;
+    
+    Chunk() : file(0), begin(NULL), end(NULL), passed(0), failed(0),
+        lines(0) {}
+};
+
+struct Histogram {
+    int bin;
+    std::vector<long long> count;
+    long long n, sum, min, max;
+    
+    Histogram(int _bin, int bins) : bin(_bin), count(bins), n(0), sum(0),
+        min(0), max(0) {}
+    
+    void add(long long v) {
+        if (v < 0) return;
+        count[std::min<long long>(v / bin, count.size() - 1)]++;
+        if (n == 0 || v < min) min = v;
+        if (n == 0 || v > max) max = v;
+        n++;
+        sum += v;
+    }
+    
+    void merge(const Histogram &o) {
+        for (size_t i = 0; i < count.size(); i++) count[i] += o.count[i];
+        if (o.n && (n == 0 || o.min < min)) min = o.min;
+        if (o.n && (n == 0 || o.max > max)) max = o.max;
+        n += o.n;
+        sum += o.sum;
+    }
+    
+    // Upper edge of the bin holding quantile q, capped at the maximum
+    long long quantile(double q) const {
+        long long want = (long long) (q * n), seen = 0;
+        for (size_t i = 0; i < count.size(); i++) {
+            seen += count[i];
+            if (seen > want) return std::min((long long) (i + 1) * bin, max);
+        }
+        return max;
+    }
+};
+
+struct Summary {
+    long long lines, events[4], passed, failed;
+    long long uri_violations, lri_violations;
+    Histogram vv, aa, avi;
+    
+    Summary() : lines(0), passed(0), failed(0), uri_violations(0),
+        lri_violations(0), vv(RR_BIN, RR_BINS), aa(RR_BIN, RR_BINS),
+        avi(AVI_BIN, AVI_BINS) {
+        memset(events, 0, sizeof(events));
+    }
+    
+    void merge(const Summary &o) {
+        lines += o.lines;
+        for (int i = 0; i < 4; i++) events[i] += o.events[i];
+        passed += o.passed;
+        failed += o.failed;
+        uri_violations += o.uri_violations;
+        lri_violations += o.lri_violations;
+        vv.merge(o.vv);
+        aa.merge(o.aa);
+        avi.merge(o.avi);
+    }
+};
+
+// Parse the trailing integer of a line, the "t - <ms>" field
+static bool last_int(const char *b, const char *e, int32_t *out) {
+    while (e > b && (e[-1] == '\r' || e[-1] == ' ')) e--;
+    const char *d = e;
+    while (d > b && d[-1] >= '0' && d[-1] <= '9') d--;
+    if (d == e) return false;
+    long long v = 0;
+    for (const char *p = d; p < e; p++) v = v * 10 + (*p - '0');
+    if (d > b && d[-1] == '-') v = -v;
+    *out = (int32_t) v;
+    return true;
+}
+
+static void scan(Chunk *c) {
+    const char *p = c->begin;
+    while (p < c->end) {
+        const char *nl = (const char *) memchr(p, '\n', c->end - p);
+        const char *e = nl ? nl : c->end;
+        c->lines++;
+        if (e - p >= 4 && p[2] == ':' && p[3] == ' ' &&
+            (p[0] == 'A' || p[0] == 'V') && (p[1] == 'P' || p[1] == 'S')) {
+            Event ev;
+            ev.type = (p[0] == 'V' ? 2 : 0) + (p[1] == 'S' ? 1 : 0);
+            if (last_int(p, e, &ev.t)) c->events.push_back(ev);
+        } else if (e - p >= 12 && memcmp(p, "Test ", 5) == 0) {
+            if (memcmp(p + 5, "passed!", 7) == 0) c->passed++;
+            else if (memcmp(p + 5, "failed!", 7) == 0) c->failed++;
+        }
+        p = e + 1;
+    }
+}
+
+// Walk one file's events in order
+static void reduce(const std::vector<Chunk *> &chunks, int uri, int lri,
+        Summary *s) {
+    bool have_v = false, have_a = false, a_open = false;
+    int32_t last_v = 0, last_a = 0;
+    for (size_t c = 0; c < chunks.size(); c++) {
+        s->lines += chunks[c]->lines;
+        s->passed += chunks[c]->passed;
+        s->failed += chunks[c]->failed;
+        const std::vector<Event> &ev = chunks[c]->events;
+        for (size_t i = 0; i < ev.size(); i++) {
+            s->events[ev[i].type]++;
+            int32_t t = ev[i].t;
+            if (ev[i].type == EV_VP || ev[i].type == EV_VS) {
+                if (have_v) {
+                    long long d = (long long) t - last_v;
+                    if (d < 0) d += T_WRAP_MS;
+                    s->vv.add(d);
+                    if (d < uri) s->uri_violations++;
+                    if (d > lri) s->lri_violations++;
+                }
+                if (a_open) {
+                    long long d = (long long) t - last_a;
+                    if (d < 0) d += T_WRAP_MS;
+                    s->avi.add(d);
+                    a_open = false;
+                }
+                have_v = true;
+                last_v = t;
+            } else {
+                if (have_a) {
+                    long long d = (long long) t - last_a;
+                    if (d < 0) d += T_WRAP_MS;
+                    s->aa.add(d);
+                }
+                have_a = true;
+                a_open = true;
+                last_a = t;
+            }
+        }
+    }
+}
+
+struct Block {
+    const uint8_t *payload;
+    int packed, raw;
+    char *out;
+};
+
+// Unpack a compressed log into text, which then takes the place of the
+// mapping. Blocks are located in one pass over their headers and decoded
+// in parallel; a torn last block is dropped with a warning.
+static bool unpack(const char *path, const char *map, size_t size,
+        int threads, std::vector<char> *text) {
+    LogzHeader header;
+    memcpy(&header, map, sizeof(header));
+    if (header.version != LOGZ_VERSION || header.block_size > LOGZ_BLOCK) {
+        fprintf(stderr, "%s: version %d, block %d not supported\n", path,
+            header.version, header.block_size);
+        return false;
+    }
+    std::vector<Block> blocks;
+    size_t raw_total = 0;
+    const uint8_t *p = (const uint8_t *) map + sizeof(header);
+    const uint8_t *end = (const uint8_t *) map + size;
+    while (p < end) {
+        Block b;
+        if (end - p < LOGZ_BLOCK_HEADER) break;
+        b.raw = p[0] | p[1] << 8;
+        b.packed = p[2] | p[3] << 8;
+        b.payload = p + LOGZ_BLOCK_HEADER;
+        int length = b.packed & ~LOGZ_STORED;
+        if (b.raw > header.block_size || length > header.block_size ||
+                end - b.payload < length) break;
+        blocks.push_back(b);
+        raw_total += b.raw;
+        p = b.payload + length;
+    }
+    if (p < end) {
+        fprintf(stderr, "%s: torn block %zu at the end, dropped\n", path,
+            blocks.size());
+    }
+    
+    text->resize(raw_total);
+    char *out = text->data();
+    for (size_t i = 0; i < blocks.size(); i++) {
+        blocks[i].out = out;
+        out += blocks[i].raw;
+    }
+    std::atomic<size_t> next(0);
+    std::atomic<bool> ok(true);
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++) {
+        pool.push_back(std::thread([&blocks, &next, &ok]() {
+            size_t i;
+            while ((i = next++) < blocks.size()) {
+                const Block &b = blocks[i];
+                if (logz_decompress(b.payload, b.packed, (uint8_t *) b.out,
+                        b.raw) != b.raw) {
+                    ok = false;
+                }
+            }
+        }));
+    }
+    for (size_t t = 0; t < pool.size(); t++) pool[t].join();
+    if (!ok) {
+        fprintf(stderr, "%s: corrupt block\n", path);
+        return false;
+    }
+    return true;
+}
+
+static std::string json_escape(const char *s) {
+    std::string r;
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') r += '\\';
+        r += *s;
+    }
+    return r;
+}
+
+static void print_hist(const char *name, const Histogram &h, const char *indent) {
+    printf("%s\"%s\": {\"n\": %lld, \"bin_ms\": %d, \"min\": %lld, "
+        "\"mean\": %.1f, \"p50\": %lld, \"p99\": %lld, \"max\": %lld, "
+        "\"counts\": [", indent, name, h.n, h.bin, h.min,
+        h.n ? (double) h.sum / h.n : 0.0, h.quantile(0.5), h.quantile(0.99),
+        h.max);
+    // Trim trailing empty bins
+    size_t last = h.count.size();
+    while (last > 0 && h.count[last - 1] == 0) last--;
+    for (size_t i = 0; i < last; i++) {
+        printf("%s%lld", i ? ", " : "", h.count[i]);
+    }
+    printf("]}");
+}
+
+static void print_summary(const Summary &s, const char *indent) {
+    long long paced = s.events[EV_AP] + s.events[EV_VP];
+    long long total = paced + s.events[EV_AS] + s.events[EV_VS];
+    long long tests = s.passed + s.failed;
+    printf("%s\"lines\": %lld,\n", indent, s.lines);
+    printf("%s\"events\": {", indent);
+    for (int i = 0; i < 4; i++) {
+        printf("%s\"%s\": %lld", i ? ", " : "", ev_name[i], s.events[i]);
+    }
+    printf("},\n");
+    printf("%s\"pacing_ratio\": %.4f,\n", indent,
+        total ? (double) paced / total : 0.0);
+    printf("%s\"atrial_pacing_ratio\": %.4f,\n", indent,
+        s.events[EV_AP] + s.events[EV_AS] ? (double) s.events[EV_AP] /
+            (s.events[EV_AP] + s.events[EV_AS]) : 0.0);
+    printf("%s\"ventricular_pacing_ratio\": %.4f,\n", indent,
+        s.events[EV_VP] + s.events[EV_VS] ? (double) s.events[EV_VP] /
+            (s.events[EV_VP] + s.events[EV_VS]) : 0.0);
+    printf("%s\"uri_violations\": %lld,\n", indent, s.uri_violations);
+    printf("%s\"lri_violations\": %lld,\n", indent, s.lri_violations);
+    printf("%s\"tests\": {\"passed\": %lld, \"failed\": %lld, "
+        "\"pass_rate\": %.4f},\n", indent, s.passed, s.failed,
+        tests ? (double) s.passed / tests : 0.0);
+    print_hist("vv_ms", s.vv, indent);
+    printf(",\n");
+    print_hist("aa_ms", s.aa, indent);
+    printf(",\n");
+    print_hist("avi_ms", s.avi, indent);
+    printf("\n");
+}
+
+int main(int argc, char **argv) {
+    int uri = 1000, lri = 2000;
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    int opt;
+    while ((opt = getopt(argc, argv, "u:l:j:h")) != -1) {
+        switch (opt) {
+        case 'u': uri = atoi(optarg); break;
+        case 'l': lri = atoi(optarg); break;
+        case 'j': threads = std::max(1, atoi(optarg)); break;
+        default:
+            fprintf(stderr, "usage: %s [-u uri_ms] [-l lri_ms] [-j threads] "
+                "log...\n", argv[0]);
+            return 1;
+        }
+    }
+    int nfiles = argc - optind;
+    if (nfiles <= 0) {
+        fprintf(stderr, "no log files given\n");
+        return 1;
+    }
+    
+    // Map every file and cut it into chunks ending on a newline
+    std::vector<std::pair<const char *, size_t> > maps(nfiles);
+    std::vector<std::vector<char> > unpacked(nfiles);
+    std::vector<Chunk> chunks;
+    for (int f = 0; f < nfiles; f++) {
+        const char *path = argv[optind + f];
+        int fd = open(path, O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) < 0) {
+            fprintf(stderr, "%s: %s\n", path, strerror(errno));
+            return 1;
+        }
+        maps[f] = std::make_pair((const char *) NULL, (size_t) st.st_size);
+        if (st.st_size > 0) {
+            void *m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (m == MAP_FAILED) {
+                fprintf(stderr, "%s: mmap: %s\n", path, strerror(errno));
+                return 1;
+            }
+            madvise(m, st.st_size, MADV_SEQUENTIAL);
+            maps[f].first = (const char *) m;
+        }
+        close(fd);
+        const char *p = maps[f].first, *end = p + st.st_size;
+        uint32_t magic = 0;
+        if (st.st_size >= (off_t) sizeof(LogzHeader)) memcpy(&magic, p, 4);
+        if (magic == LOGZ_MAGIC) {
+            if (!unpack(path, p, st.st_size, threads, &unpacked[f])) return 1;
+            p = unpacked[f].data();
+            end = p + unpacked[f].size();
+        }
+        while (p < end) {
+            const char *e = p + std::min<size_t>(CHUNK_BYTES, end - p);
+            if (e < end) {
+                const char *nl = (const char *) memchr(e, '\n', end - e);
+                e = nl ? nl + 1 : end;
+            }
+            Chunk c;
+            c.file = f;
+            c.begin = p;
+            c.end = e;
+            chunks.push_back(c);
+            p = e;
+        }
+    }
+    
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++) {
+        pool.push_back(std::thread([&chunks, &next]() {
+            size_t i;
+            while ((i = next++) < chunks.size()) scan(&chunks[i]);
+        }));
+    }
+    for (size_t t = 0; t < pool.size(); t++) pool[t].join();
+    
+    std::vector<Summary> per_file(nfiles);
+    Summary all;
+    printf("{\n  \"uri_ms\": %d,\n  \"lri_ms\": %d,\n  \"files\": [\n", uri, lri);
+    for (int f = 0; f < nfiles; f++) {
+        std::vector<Chunk *> mine;
+        for (size_t i = 0; i < chunks.size(); i++) {
+            if (chunks[i].file == f) mine.push_back(&chunks[i]);
+        }
+        reduce(mine, uri, lri, &per_file[f]);
+        all.merge(per_file[f]);
+        printf("    {\n      \"file\": \"%s\",\n",
+            json_escape(argv[optind + f]).c_str());
+        print_summary(per_file[f], "      ");
+        printf("    }%s\n", f + 1 < nfiles ? "," : "");
+    }
+    printf("  ],\n  \"aggregate\": {\n");
+    print_summary(all, "    ");
+    printf("  }\n}\n");
+    
+    for (int f = 0; f < nfiles; f++) {
+        if (maps[f].first) munmap((void *) maps[f].first, maps[f].second);
+    }
+    return 0;
+}
@@ -0,0 +1,88 @@
+// Turn a compressed heart log (/local/logNNN.lgz, see logz.h) back into the
+// text Logger would have written.
+//
+// Build and run from this directory:
+//   g++ -O2 -std=c++11 -I.. log_unpack.cpp ../logz.cpp -o log_unpack
+//   ./log_unpack [-v] log000.lgz > log000.txt      # or - for stdin
+//
+// A torn last block, as left by a board that lost power, ends the output
+// with a warning. -v prints block count and ratio to stderr.
+
+#include "logz.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+int main(int argc, char **argv) {
+    bool verbose = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "vh")) != -1) {
+        switch (opt) {
+        case 'v': verbose = true; break;
+        default:
+            fprintf(stderr, "usage: %s [-v] log.lgz\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "usage: %s [-v] log.lgz\n", argv[0]);
+        return 1;
+    }
+    const char *path = argv[optind];
+    FILE *in = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (in == NULL) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    
+    LogzHeader header;
+    if (fread(&header, sizeof(header), 1, in) != 1 ||
+            header.magic != LOGZ_MAGIC) {
+        fprintf(stderr, "%s: not a compressed log\n", path);
+        return 1;
+    }
+    if (header.version != LOGZ_VERSION || header.block_size > LOGZ_BLOCK) {
+        fprintf(stderr, "%s: version %d, block %d not supported\n", path,
+            header.version, header.block_size);
+        return 1;
+    }
+    
+    static uint8_t payload[LOGZ_BLOCK + LOGZ_BLOCK_HEADER];
+    static uint8_t text[LOGZ_BLOCK];
+    long long blocks = 0, stored = 0, raw_total = 0;
+    long long packed_total = sizeof(header);
+    int rc = 0;
+    uint8_t h[LOGZ_BLOCK_HEADER];
+    size_t got;
+    while ((got = fread(h, 1, sizeof(h), in)) > 0) {
+        int raw = h[0] | h[1] << 8;
+        int packed = h[2] | h[3] << 8;
+        int length = packed & ~LOGZ_STORED;
+        if (got != sizeof(h) || raw > header.block_size ||
+                length > header.block_size ||
+                fread(payload, 1, length, in) != (size_t) length) {
+            fprintf(stderr, "%s: torn block %lld at the end\n", path, blocks);
+            rc = 1;
+            break;
+        }
+        if (logz_decompress(payload, packed, text, raw) != raw) {
+            fprintf(stderr, "%s: block %lld is corrupt\n", path, blocks);
+            rc = 1;
+            break;
+        }
+        fwrite(text, 1, raw, stdout);
+        blocks++;
+        if (packed & LOGZ_STORED) stored++;
+        raw_total += raw;
+        packed_total += LOGZ_BLOCK_HEADER + length;
+    }
+    if (in != stdin) fclose(in);
+    
+    if (verbose) {
+        fprintf(stderr, "%lld blocks (%lld stored), %lld -> %lld bytes, "
+            "ratio %.2f\n", blocks, stored, packed_total, raw_total,
+            packed_total ? (double) raw_total / packed_total : 0.0);
+    }
+    return rc;
+}
@@ -0,0 +1,498 @@
+// Explicit-state model checker for the pacing logic in pacing.cpp.
+//
+// Build and run from this directory:
+//   g++ -O3 -march=native -std=c++11 -pthread -I.. model_check.cpp ../pacing.cpp ../params.cpp ../format.cpp -o model_check
+//   ./model_check [-q quantum_ms] [-b depth] [-j threads] [-m log2_slots]
+//                 [-p params.txt] [-M] [-F]
+//
+// The state is what pace_thread keeps between decisions: the Pacing fields,
+// the two clocks and the feature switches. From every state the environment
+// may, at the current instant, deliver an AS or VS, switch the pace mode or
+// toggle a feature switch ('x'/'d' on the console), or let time pass. Time
+// passes in steps of the quantum, or less when the pacing deadline comes
+// first, in which case the pace is emitted exactly at the deadline, as the
+// signal_wait timeout does on the board. Clocks saturate just above the
+// largest constant they are compared with, which keeps the space finite.
+// With the default parameters a 10 ms quantum reaches its fixpoint at 1M
+// states and 2 ms at 57M, about 25 s on one core; -q 1 needs -m 28.
+//
+// Properties, after query.q:
+//   ap_timing   AP only at cV == LRI[mode] - AVI_min, with cV >= PVARP
+//   vp_timing   VP only at cA == AVI (AVI > AVI_min), or at cV == LRI[mode]
+//               with cV > URI[mode] and cV > VRP
+//   v_slow      cV never passes LRI[mode] (alarmSlow is never needed)
+//   vs_fast     no VS is accepted below URI[mode] (alarmFast)
+//   deadlock    every state has a successor
+// After a mode change or toggle, until the next ventricular event, the
+// timing equalities relax to >= and v_slow is not checked. MANUAL mode is
+// left out unless -M is given; only deadlock is checked in it. The LED
+// properties of query.q concern the UPPAAL model only.
+//
+// The search is a level-synchronous BFS, so counterexamples are shortest.
+// Worker threads share one lock-free open-addressing table. Each 64-bit
+// slot holds a 36-bit fingerprint of the state and the slot of its BFS
+// parent, so states are never stored; a fingerprint collision may prune a
+// state. Traces are rebuilt by following parents back to a root and
+// replaying the successor whose fingerprint matches each step.
+
+#include "pacing.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define SLOT_BITS_MAX 28
+#define PARENT_BITS 28
+#define PARENT_MASK ((1ull << PARENT_BITS) - 1)
+#define NO_PARENT PARENT_MASK
+#define CHUNK 1024
+#define MAX_SUCCESSORS 16
+
+// Packed state, low bits first
+#define S_MODE(s)     ((int) ((s) & 3))
+#define S_VNEXT(s)    ((int) (((s) >> 2) & 1))
+#define S_EXTLAST(s)  ((int) (((s) >> 3) & 1))
+#define S_CHANGED(s)  ((int) (((s) >> 4) & 1))
+#define S_XPVARP(s)   ((int) (((s) >> 5) & 1))
+#define S_DYNAVI(s)   ((int) (((s) >> 6) & 1))
+#define S_AVI(s)      ((int) (((s) >> 7) & 0xFF))
+#define S_CA(s)       ((int) (((s) >> 15) & 0xFFF))
+#define S_CV(s)       ((int) (((s) >> 27) & 0xFFF))
+
+enum Action {
+    TICK, AP_PACE, VP_PACE, AS_SENSE, VS_SENSE, TO_NORMAL, TO_SLEEP,
+    TO_EXERCISE, TO_MANUAL, TOGGLE_X, TOGGLE_D, MANUAL_AP, MANUAL_VP
+};
+
+static const char *action_name[] = {
+    "tick", "AP", "VP", "AS", "VS", "normal", "sleep", "exercise", "manual",
+    "toggle x", "toggle d", "manual AP", "manual VP"
+};
+
+enum Property { AP_TIMING, VP_TIMING, V_SLOW, VS_FAST, DEADLOCK, PROPERTY_COUNT };
+
+static const char *property_name[] = {
+    "ap_timing", "vp_timing", "v_slow", "vs_fast", "deadlock"
+};
+
+static const char *mode_name[] = { "normal", "sleep", "exercise", "manual" };
+
+struct Step {
+    uint64_t state;
+    int action;
+    int elapsed;
+    int violated;   // bit per Property
+};
+
+struct Model {
+    PaceParams params;
+    int quantum;
+    int ca_cap, cv_cap;
+    bool manual;
+    bool toggles;
+
+    static uint64_t pack(const Pacing &pc, int changed, int xpvarp, int dynavi,
+            int ca, int cv) {
+        return (uint64_t) pc.mode | (uint64_t) pc.vnext << 2 |
+            (uint64_t) pc.extend_last << 3 | (uint64_t) changed << 4 |
+            (uint64_t) xpvarp << 5 | (uint64_t) dynavi << 6 |
+            (uint64_t) pc.dynamic_AVI << 7 | (uint64_t) ca << 15 |
+            (uint64_t) cv << 27;
+    }
+
+    static void unpack(uint64_t s, Pacing *pc) {
+        pc->mode = (Pacemode) S_MODE(s);
+        pc->vnext = S_VNEXT(s);
+        pc->extend_last = S_EXTLAST(s);
+        pc->dynamic_AVI = S_AVI(s);
+    }
+
+    PaceParams params_of(uint64_t s) const {
+        PaceParams p = params;
+        p.extend_pvarp = S_XPVARP(s);
+        p.dynamic_avi = S_DYNAVI(s);
+        return p;
+    }
+
+    void roots(std::vector<uint64_t> &out) const {
+        // pace.cpp starts cV 30-99 ms after cA, in NORMAL mode, with any
+        // combination of feature switches loaded from params.txt
+        for (int x = 0; x < 2; x++) {
+            for (int d = 0; d < 2; d++) {
+                for (int skew = 30; skew < 100; skew++) {
+                    Pacing pc;
+                    out.push_back(pack(pc, 0, x, d, std::min(skew, ca_cap), 0));
+                }
+            }
+        }
+    }
+
+    int successors(uint64_t s, Step *out) const {
+        int n = 0;
+        Pacing pc;
+        unpack(s, &pc);
+        PaceParams p = params_of(s);
+        int mode = S_MODE(s);
+        int changed = S_CHANGED(s);
+        int x = S_XPVARP(s), d = S_DYNAVI(s);
+        int ca = S_CA(s), cv = S_CV(s);
+
+        // Mode changes and feature toggles at the current instant
+        for (int m = NORMAL; m <= MANUAL; m++) {
+            if (m == mode || (m == MANUAL && !manual)) continue;
+            Pacing next = pc;
+            next.mode = (Pacemode) m;
+            add(out, n, pack(next, 1, x, d, ca, cv), TO_NORMAL + m, 0, 0);
+        }
+        if (toggles) {
+            add(out, n, pack(pc, 1, !x, d, ca, cv), TOGGLE_X, 0, 0);
+            add(out, n, pack(pc, 1, x, !d, ca, cv), TOGGLE_D, 0, 0);
+        }
+
+        if (mode == MANUAL) {
+            Pacing a = pc;
+            a.manual_a();
+            add(out, n, pack(a, changed, x, d, 0, cv), MANUAL_AP, 0, 0);
+            Pacing v = pc;
+            v.manual_v();
+            add(out, n, pack(v, changed, x, d, ca, 0), MANUAL_VP, 0, 0);
+            add(out, n, pack(pc, changed, x, d, std::min(ca + quantum, ca_cap),
+                std::min(cv + quantum, cv_cap)), TICK, quantum, 0);
+            return n;
+        }
+
+        // Senses; a rejected one leaves the state as it was
+        Pacing a = pc;
+        if (a.sense_a(p, ca, cv)) {
+            add(out, n, pack(a, changed, x, d, 0, cv), AS_SENSE, 0, 0);
+        }
+        Pacing v = pc;
+        if (v.sense_v(p, ca, cv)) {
+            int bad = cv < p.uri[mode] ? 1 << VS_FAST : 0;
+            add(out, n, pack(v, 0, x, d, ca, 0), VS_SENSE, 0, bad);
+        }
+
+        // Time passes up to the quantum or the deadline
+        int deadline = pc.next(p, ca, cv);
+        int dt = std::min(quantum, deadline);
+        int ca2 = std::min(ca + dt, ca_cap);
+        int cv2 = std::min(cv + dt, cv_cap);
+        if (dt < deadline) {
+            int bad = !changed && cv2 > p.lri[mode] ? 1 << V_SLOW : 0;
+            add(out, n, pack(pc, changed, x, d, ca2, cv2), TICK, dt, bad);
+            return n;
+        }
+        Pacing after = pc;
+        int avi = p.dynamic_avi ? pc.dynamic_AVI : p.avi_max;
+        if (after.pace(p, ca2, cv2) == PACE_AP) {
+            int at = p.lri[mode] - p.avi_min;
+            bool ok = (changed ? cv2 >= at : cv2 == at) && cv2 >= p.pvarp;
+            add(out, n, pack(after, changed, x, d, 0, cv2), AP_PACE, dt,
+                ok ? 0 : 1 << AP_TIMING);
+        } else {
+            bool av = (changed ? ca2 >= avi : ca2 == avi) && avi > p.avi_min;
+            bool lr = (changed ? cv2 >= p.lri[mode] : cv2 == p.lri[mode]) &&
+                cv2 > p.uri[mode] && cv2 > p.vrp;
+            add(out, n, pack(after, 0, x, d, ca2, 0), VP_PACE, dt,
+                av || lr ? 0 : 1 << VP_TIMING);
+        }
+        return n;
+    }
+
+    static void add(Step *out, int &n, uint64_t s, int action, int elapsed,
+            int violated) {
+        out[n].state = s;
+        out[n].action = action;
+        out[n].elapsed = elapsed;
+        out[n].violated = violated;
+        n++;
+    }
+};
+
+static inline uint64_t mix(uint64_t s) {
+    s += 0x9E3779B97F4A7C15ull;
+    s = (s ^ (s >> 30)) * 0xBF58476D1CE4E5B9ull;
+    s = (s ^ (s >> 27)) * 0x94D049BB133111EBull;
+    return s ^ (s >> 31);
+}
+
+// Fingerprint from the bits the slot index does not use, never 0
+static inline uint64_t fingerprint(uint64_t h) {
+    uint64_t fp = h >> PARENT_BITS;
+    return fp ? fp : 1;
+}
+
+class Visited {
+    public:
+    Visited(int bits) : mask((1ull << bits) - 1), used(0),
+        table(new std::atomic<uint64_t>[1ull << bits]) {
+        for (uint64_t i = 0; i <= mask; i++) {
+            table[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    ~Visited() { delete[] table; }
+
+    // Slot of a newly inserted state, or -1 when it was seen before
+    int64_t insert(uint64_t state, uint64_t parent) {
+        uint64_t h = mix(state);
+        uint64_t fp = fingerprint(h);
+        uint64_t entry = fp << PARENT_BITS | parent;
+        for (uint64_t i = h & mask, probes = 0; probes <= mask;
+                i = (i + 1) & mask, probes++) {
+            uint64_t cur = table[i].load(std::memory_order_relaxed);
+            while (cur == 0) {
+                if (table[i].compare_exchange_weak(cur, entry,
+                        std::memory_order_relaxed)) {
+                    used.fetch_add(1, std::memory_order_relaxed);
+                    return (int64_t) i;
+                }
+            }
+            if (cur >> PARENT_BITS == fp) {
+                return -1;
+            }
+        }
+        fprintf(stderr, "visited table full, raise -m\n");
+        exit(2);
+    }
+
+    uint64_t parent(uint64_t slot) const {
+        return table[slot].load(std::memory_order_relaxed) & PARENT_MASK;
+    }
+
+    uint64_t fp(uint64_t slot) const {
+        return table[slot].load(std::memory_order_relaxed) >> PARENT_BITS;
+    }
+
+    uint64_t size() const { return used.load(); }
+    uint64_t capacity() const { return mask + 1; }
+
+    private:
+    uint64_t mask;
+    std::atomic<uint64_t> used;
+    std::atomic<uint64_t> *table;
+};
+
+struct Node {
+    uint64_t state;
+    uint64_t slot;
+};
+
+struct Violation {
+    bool found;
+    int depth;
+    uint64_t slot;      // state the bad transition leaves from
+    Step step;
+};
+
+static void print_state(uint64_t s) {
+    printf("%-8s ca=%4d cv=%4d vnext=%d ext=%d avi=%3d x=%d d=%d%s",
+        mode_name[S_MODE(s)], S_CA(s), S_CV(s), S_VNEXT(s), S_EXTLAST(s),
+        S_AVI(s), S_XPVARP(s), S_DYNAVI(s), S_CHANGED(s) ? " changed" : "");
+}
+
+// Rebuild the path to slot by replaying the successors whose fingerprints
+// match the parent chain
+static void print_trace(const Model &model, const Visited &visited,
+        const std::vector<uint64_t> &roots, const Violation &v) {
+    std::vector<uint64_t> chain;
+    for (uint64_t s = v.slot; s != NO_PARENT; s = visited.parent(s)) {
+        chain.push_back(s);
+    }
+    std::reverse(chain.begin(), chain.end());
+
+    uint64_t state = 0;
+    bool found = false;
+    for (size_t i = 0; i < roots.size() && !found; i++) {
+        if (fingerprint(mix(roots[i])) == visited.fp(chain[0])) {
+            state = roots[i];
+            found = true;
+        }
+    }
+    long long t = 0;
+    printf("  %8s  %-10s ", "t_ms", "start");
+    print_state(state);
+    printf("\n");
+    for (size_t i = 1; i < chain.size(); i++) {
+        Step steps[MAX_SUCCESSORS];
+        int n = model.successors(state, steps);
+        int k = 0;
+        while (k < n && fingerprint(mix(steps[k].state)) != visited.fp(chain[i])) {
+            k++;
+        }
+        if (k == n) {
+            printf("  (trace lost: fingerprint not among successors)\n");
+            return;
+        }
+        t += steps[k].elapsed;
+        state = steps[k].state;
+        if (steps[k].action == TICK) continue;
+        printf("  %8lld  %-10s ", t, action_name[steps[k].action]);
+        print_state(state);
+        printf("\n");
+    }
+    t += v.step.elapsed;
+    printf("  %8lld  %-10s ", t, action_name[v.step.action]);
+    print_state(v.step.state);
+    printf("  <-- violation\n");
+}
+
+int main(int argc, char **argv) {
+    Model model;
+    params_defaults(&model.params);
+    model.quantum = 10;
+    model.manual = false;
+    model.toggles = true;
+    int depth_bound = 0;
+    // hardware_concurrency() is 0 when unknown
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    int bits = 26;
+    int opt;
+    while ((opt = getopt(argc, argv, "q:b:j:m:p:MFh")) != -1) {
+        switch (opt) {
+        case 'q': model.quantum = std::max(atoi(optarg), 1); break;
+        case 'b': depth_bound = atoi(optarg); break;
+        case 'j': threads = std::max(atoi(optarg), 1); break;
+        case 'm': bits = std::max(10, std::min(atoi(optarg), SLOT_BITS_MAX)); break;
+        case 'p':
+            if (params_load(&model.params, optarg) < 0) {
+                fprintf(stderr, "%s: %s\n", optarg, strerror(errno));
+                return 1;
+            }
+            break;
+        case 'M': model.manual = true; break;
+        case 'F': model.toggles = false; break;
+        default:
+            fprintf(stderr, "usage: %s [-q quantum_ms] [-b depth] [-j threads] "
+                "[-m log2_slots] [-p params.txt] [-M] [-F]\n", argv[0]);
+            return 1;
+        }
+    }
+    const PaceParams &p = model.params;
+    // Just above every constant a clock is compared with
+    model.ca_cap = std::max(std::max(p.avi_max, p.avi_min), DYNAMIC_AV_MAX) + 1;
+    model.cv_cap = std::max(p.pvarp + p.pvarp_extend, p.vrp) + 1;
+    for (int m = 0; m < 4; m++) {
+        model.cv_cap = std::max(model.cv_cap, std::max(p.lri[m], p.uri[m]) + 1);
+    }
+    if (model.cv_cap > 0xFFF || DYNAMIC_AV_MAX > 0xFF) {
+        fprintf(stderr, "constants too large for the state encoding\n");
+        return 1;
+    }
+
+    Visited visited(bits);
+    std::vector<uint64_t> roots;
+    model.roots(roots);
+    std::vector<Node> frontier;
+    for (size_t i = 0; i < roots.size(); i++) {
+        int64_t slot = visited.insert(roots[i], NO_PARENT);
+        if (slot >= 0) {
+            Node node = { roots[i], (uint64_t) slot };
+            frontier.push_back(node);
+        }
+    }
+    // Nothing to explore would otherwise read as a fixpoint with every
+    // property holding
+    if (frontier.empty()) {
+        fprintf(stderr, "no initial states\n");
+        return 1;
+    }
+
+    Violation violations[PROPERTY_COUNT];
+    memset(violations, 0, sizeof(violations));
+    std::mutex violation_mutex;
+    std::atomic<uint64_t> transitions(0);
+
+    auto start = std::chrono::steady_clock::now();
+    int depth = 0;
+    while (!frontier.empty() && (depth_bound == 0 || depth < depth_bound)) {
+        std::atomic<size_t> next_chunk(0);
+        std::vector<std::vector<Node> > found(threads);
+        std::vector<std::thread> pool;
+        for (int t = 0; t < threads; t++) {
+            pool.push_back(std::thread([&, t]() {
+                std::vector<Node> &out = found[t];
+                uint64_t local_transitions = 0;
+                Step steps[MAX_SUCCESSORS];
+                while (true) {
+                    size_t begin = next_chunk.fetch_add(CHUNK);
+                    if (begin >= frontier.size()) break;
+                    size_t end = std::min(begin + CHUNK, frontier.size());
+                    for (size_t i = begin; i < end; i++) {
+                        const Node &node = frontier[i];
+                        int n = model.successors(node.state, steps);
+                        local_transitions += n;
+                        int bad = n == 0 ? 1 << DEADLOCK : 0;
+                        for (int k = 0; k < n; k++) {
+                            bad |= steps[k].violated;
+                            int64_t slot = visited.insert(steps[k].state, node.slot);
+                            if (slot >= 0) {
+                                Node next = { steps[k].state, (uint64_t) slot };
+                                out.push_back(next);
+                            }
+                        }
+                        if (!bad) continue;
+                        std::lock_guard<std::mutex> lock(violation_mutex);
+                        for (int prop = 0; prop < PROPERTY_COUNT; prop++) {
+                            if (!(bad & 1 << prop) || violations[prop].found) continue;
+                            Violation &v = violations[prop];
+                            v.found = true;
+                            v.depth = depth + 1;
+                            v.slot = node.slot;
+                            memset(&v.step, 0, sizeof(v.step));
+                            v.step.state = node.state;
+                            for (int k = 0; k < n; k++) {
+                                if (steps[k].violated & 1 << prop) v.step = steps[k];
+                            }
+                        }
+                    }
+                }
+                transitions.fetch_add(local_transitions);
+            }));
+        }
+        for (size_t t = 0; t < pool.size(); t++) {
+            pool[t].join();
+        }
+        frontier.clear();
+        for (int t = 0; t < threads; t++) {
+            frontier.insert(frontier.end(), found[t].begin(), found[t].end());
+        }
+        depth++;
+    }
+    double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+
+    bool complete = frontier.empty();
+    printf("quantum %d ms, %s, depth %d%s, %d threads\n", model.quantum,
+        model.manual ? "all modes" : "automatic modes", depth,
+        complete ? " (fixpoint)" : " (bound reached)", threads);
+    printf("%llu states, %llu transitions in %.2f s, table %.1f%% full\n",
+        (unsigned long long) visited.size(),
+        (unsigned long long) transitions.load(), seconds,
+        100.0 * visited.size() / visited.capacity());
+
+    if (visited.size() > visited.capacity() / 4 * 3) {
+        printf("table over 75%% full, raise -m to limit fingerprint collisions\n");
+    }
+
+    int failed = 0;
+    for (int prop = 0; prop < PROPERTY_COUNT; prop++) {
+        const Violation &v = violations[prop];
+        if (!v.found) {
+            printf("%-10s holds\n", property_name[prop]);
+            continue;
+        }
+        failed++;
+        printf("%-10s VIOLATED at depth %d\n", property_name[prop], v.depth);
+        print_trace(model, visited, roots, v);
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,397 @@
+// One pacemaker and one heart, pace_thread against heart_thread's RANDOM
+// mode plus the pacemaker's rate alarms, run event by event in virtual
+// time, with checkpoints to rewind to.
+//
+// Build and run from this directory:
+//   g++ -O2 -std=c++11 -I.. pair_sim.cpp ../pacing.cpp ../params.cpp ../format.cpp ../rhythm.cpp -o pair_sim
+//   ./pair_sim [-t seconds] [-s seed] [-r profile] [-m mode] [-e] [-d]
+//              [-p params.txt] [-a fast|slow|any|none] [-k count]
+//              [-c checkpoint_s] [-n checkpoints] [-W lead_ms]
+//              [-T from_ms] [-v]
+//
+// The whole simulated system, pacing state, clocks, rhythm generator with
+// its RNG, pending deadlines and alarm thread, is one trivially copyable
+// struct of a few hundred bytes, so a checkpoint is a copy into a ring
+// taken every -c seconds of virtual time, and a rewind copies it back.
+// Integer time and a seeded RNG make every rerun from a checkpoint take
+// exactly the same path.
+//
+// The run stops at the -k'th alarm of the kind given with -a, or at a
+// failed assertion: no ventricular gap above the mode's LRI. It then
+// rewinds to the last checkpoint at least -W ms before the stop, reruns
+// to it printing every event, and checks it ends in the same state. -T
+// traces from a given virtual time instead; -v traces the whole run.
+
+#include "pacing.h"
+#include "rhythm.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <type_traits>
+#include <vector>
+
+// Tolerance of the alarm thread in pace.cpp, and how long it shows one
+#define ALARM_INTERVAL 15
+#define ALARM_HOLD 5000
+
+enum StopOn { STOP_NONE, STOP_FAST, STOP_SLOW, STOP_ANY };
+
+enum Event { EV_NONE, EV_AS, EV_VS, EV_AP, EV_VP, EV_ALARM_FAST,
+    EV_ALARM_SLOW, EV_HOLD_END, EV_ASSERT };
+
+static const char *event_name[] = { "-", "AS", "VS", "AP", "VP",
+    "ERR_FAST", "ERR_SLOW", "alarm cleared", "ASSERT" };
+
+struct PairState {
+    // Virtual time in ms, and events processed
+    uint64_t now;
+    uint64_t events;
+    // Last accepted atrial/ventricular event, for cA and cV
+    uint64_t a_mark;
+    uint64_t v_mark;
+    // The heart's next beat and the pacemaker's deadline
+    uint64_t heart_due;
+    uint64_t pace_due;
+    uint8_t heart_chamber;
+    Rhythm rhythm;
+    Pacing pacing;
+    // alarm_thread: its timer, whether a V has been seen since it was
+    // reset, and the end of an alarm being shown, during which V events
+    // stay pending
+    uint64_t alarm_ref;
+    bool alarm_first;
+    bool alarm_pending;
+    uint64_t alarm_hold;
+    // Last V event of any kind, for the assertion
+    uint64_t last_v;
+    uint64_t ap, vp, as_seen, as_accepted, vs_seen, vs_accepted;
+    uint64_t alarms_fast, alarms_slow;
+};
+
+static_assert(std::is_trivially_copyable<PairState>::value,
+    "checkpoints copy PairState as bytes");
+
+static PaceParams params;
+
+static uint64_t state_hash(const PairState &s) {
+    const uint8_t *p = (const uint8_t *) &s;
+    uint64_t h = 0xCBF29CE484222325ull;
+    for (size_t i = 0; i < sizeof(s); i++) {
+        h = (h ^ p[i]) * 0x100000001B3ull;
+    }
+    return h;
+}
+
+static void format_time(uint64_t ms, char *out, size_t n) {
+    snprintf(out, n, "%02llu:%02llu:%02llu.%03llu",
+        (unsigned long long) (ms / 3600000), (unsigned long long) (ms / 60000 % 60),
+        (unsigned long long) (ms / 1000 % 60), (unsigned long long) (ms % 1000));
+}
+
+static void init(PairState *s, uint64_t seed, RhythmProfile profile, Pacemode mode) {
+    // Zero the padding too, so equal states hash equal
+    memset((void *) s, 0, sizeof(*s));
+    s->rhythm.reset(profile, seed);
+    s->pacing = Pacing();
+    s->pacing.mode = mode;
+    // Match the startup skew between cA and cV in pace.cpp
+    s->v_mark = s->rhythm.rng.below(70) + 30;
+    s->a_mark = 0;
+    s->now = s->v_mark;
+    Beat b = s->rhythm.next();
+    s->heart_due = s->now + b.interval;
+    s->heart_chamber = b.chamber;
+    s->pace_due = s->now + s->pacing.next(params, 0, 0);
+    s->alarm_ref = s->now;
+    s->alarm_first = true;
+    s->last_v = s->now;
+}
+
+static int ca(const PairState &s) {
+    return (int) (s.now - s.a_mark);
+}
+
+static int cv(const PairState &s) {
+    return (int) (s.now - s.v_mark);
+}
+
+// The alarm thread sees a VP or VS
+static Event alarm_v(PairState *s) {
+    if (s->now < s->alarm_hold) {
+        s->alarm_pending = true;
+        return EV_NONE;
+    }
+    if (!s->alarm_first &&
+            s->now - s->alarm_ref < (uint64_t) params.uri[s->pacing.mode]) {
+        s->alarm_hold = s->now + ALARM_HOLD;
+        s->alarms_fast++;
+        return EV_ALARM_FAST;
+    }
+    s->alarm_ref = s->now;
+    s->alarm_first = false;
+    return EV_NONE;
+}
+
+static bool check_gap(PairState *s) {
+    bool ok = s->now - s->last_v <= (uint64_t) params.lri[s->pacing.mode];
+    s->last_v = s->now;
+    return ok;
+}
+
+// Advances to the next event and handles it. Returns what happened; an
+// alarm or a failed assertion takes precedence over the V that raised it.
+static Event step(PairState *s) {
+    uint64_t slow_due = s->alarm_hold > s->alarm_ref ? s->alarm_hold :
+        s->alarm_ref + params.lri[s->pacing.mode] + ALARM_INTERVAL;
+    uint64_t t = std::min(s->heart_due, std::min(s->pace_due, slow_due));
+    s->now = t;
+    s->events++;
+    Event ev = EV_NONE;
+    Event extra = EV_NONE;
+    
+    // A sense arriving together with the deadline wins, as in pace_thread
+    // where a pending signal preempts the timeout
+    if (s->heart_due == t) {
+        if (s->heart_chamber == RHYTHM_A) {
+            ev = EV_AS;
+            s->as_seen++;
+            if (s->pacing.sense_a(params, ca(*s), cv(*s))) {
+                s->a_mark = t;
+                s->as_accepted++;
+            }
+        } else {
+            ev = EV_VS;
+            s->vs_seen++;
+            bool gap_ok = true;
+            if (s->pacing.sense_v(params, ca(*s), cv(*s))) {
+                gap_ok = check_gap(s);
+                s->v_mark = t;
+                s->vs_accepted++;
+            }
+            // v_sense signals the alarm thread whether accepted or not
+            extra = alarm_v(s);
+            if (!gap_ok) extra = EV_ASSERT;
+        }
+        Beat b = s->rhythm.next();
+        s->heart_due = t + (b.interval > 0 ? b.interval : 1);
+        s->heart_chamber = b.chamber;
+        s->pace_due = t + s->pacing.next(params, ca(*s), cv(*s));
+    } else if (s->pace_due == t) {
+        if (s->pacing.pace(params, ca(*s), cv(*s)) == PACE_VP) {
+            ev = EV_VP;
+            s->vp++;
+            bool gap_ok = check_gap(s);
+            s->v_mark = t;
+            extra = alarm_v(s);
+            if (!gap_ok) extra = EV_ASSERT;
+        } else {
+            ev = EV_AP;
+            s->ap++;
+            s->a_mark = t;
+        }
+        s->pace_due = t + s->pacing.next(params, ca(*s), cv(*s));
+    } else if (s->alarm_hold == t) {
+        // Signals that came in while the alarm showed wake it at once
+        ev = EV_HOLD_END;
+        s->alarm_ref = t;
+        s->alarm_first = !s->alarm_pending;
+        s->alarm_pending = false;
+        s->alarm_hold = 0;
+    } else {
+        ev = EV_ALARM_SLOW;
+        s->alarms_slow++;
+        s->alarm_hold = t + ALARM_HOLD;
+    }
+    return extra != EV_NONE ? extra : ev;
+}
+
+static void trace(const PairState &s, Event ev) {
+    char when[32];
+    format_time(s.now, when, sizeof(when));
+    printf("%s %-13s cA %5d cV %5d  next heart %s in %llu, pace in %llu\n",
+        when, event_name[ev], ca(s), cv(s),
+        s.heart_chamber == RHYTHM_A ? "AS" : "VS",
+        (unsigned long long) (s.heart_due - s.now),
+        (unsigned long long) (s.pace_due - s.now));
+}
+
+static bool stops(StopOn on, Event ev) {
+    return ev == EV_ASSERT ||
+        (ev == EV_ALARM_FAST && (on == STOP_FAST || on == STOP_ANY)) ||
+        (ev == EV_ALARM_SLOW && (on == STOP_SLOW || on == STOP_ANY));
+}
+
+// Ring of the latest checkpoints, oldest overwritten first
+struct Checkpoints {
+    std::vector<PairState> ring;
+    size_t head;
+    size_t count;
+    // Whether the first checkpoint, the start of the run, is gone
+    bool overwritten;
+    
+    Checkpoints(size_t n) : ring(n), head(0), count(0), overwritten(false) {}
+    
+    void take(const PairState &s) {
+        if (count == ring.size()) overwritten = true;
+        ring[head] = s;
+        head = (head + 1) % ring.size();
+        if (count < ring.size()) count++;
+    }
+    
+    // Latest checkpoint at or before t, NULL if all are later
+    const PairState *before(uint64_t t) const {
+        for (size_t i = 0; i < count; i++) {
+            const PairState &c = ring[(head + ring.size() - 1 - i) % ring.size()];
+            if (c.now <= t) return &c;
+        }
+        return NULL;
+    }
+    
+    const PairState &oldest() const {
+        return ring[(head + ring.size() - count) % ring.size()];
+    }
+};
+
+int main(int argc, char **argv) {
+    long long seconds = 86400;
+    uint64_t seed = 1;
+    RhythmProfile profile = RHYTHM_RANDOM;
+    Pacemode mode = NORMAL;
+    StopOn stop_on = STOP_ANY;
+    long long stop_count = 1;
+    long long checkpoint_s = 60;
+    long long ring_size = 256;
+    long long lead_ms = 10000;
+    long long from_ms = -1;
+    bool verbose = false;
+    params_defaults(&params);
+    int opt;
+    while ((opt = getopt(argc, argv, "t:s:r:m:edp:a:k:c:n:W:T:vh")) != -1) {
+        switch (opt) {
+        case 't': seconds = atoll(optarg); break;
+        case 's': seed = strtoull(optarg, NULL, 0); break;
+        case 'r': {
+            int r = 0;
+            while (r < RHYTHM_COUNT && strcmp(optarg, rhythm_name[r]) != 0) r++;
+            if (r == RHYTHM_COUNT) {
+                fprintf(stderr, "unknown profile %s\n", optarg);
+                return 1;
+            }
+            profile = (RhythmProfile) r;
+            break;
+        }
+        case 'm':
+            if (strcmp(optarg, "normal") == 0) mode = NORMAL;
+            else if (strcmp(optarg, "sleep") == 0) mode = SLEEP;
+            else if (strcmp(optarg, "exercise") == 0) mode = EXERCISE;
+            else { fprintf(stderr, "unknown mode %s\n", optarg); return 1; }
+            break;
+        case 'e': params.extend_pvarp = 1; break;
+        case 'd': params.dynamic_avi = 1; break;
+        case 'p':
+            if (params_load(&params, optarg) < 0) {
+                fprintf(stderr, "%s: %s\n", optarg, strerror(errno));
+                return 1;
+            }
+            break;
+        case 'a':
+            if (strcmp(optarg, "fast") == 0) stop_on = STOP_FAST;
+            else if (strcmp(optarg, "slow") == 0) stop_on = STOP_SLOW;
+            else if (strcmp(optarg, "any") == 0) stop_on = STOP_ANY;
+            else if (strcmp(optarg, "none") == 0) stop_on = STOP_NONE;
+            else { fprintf(stderr, "unknown alarm %s\n", optarg); return 1; }
+            break;
+        case 'k': stop_count = atoll(optarg); break;
+        case 'c': checkpoint_s = atoll(optarg); break;
+        case 'n': ring_size = atoll(optarg); break;
+        case 'W': lead_ms = atoll(optarg); break;
+        case 'T': from_ms = atoll(optarg); break;
+        case 'v': verbose = true; break;
+        default:
+            fprintf(stderr, "usage: %s [-t seconds] [-s seed] [-r profile] "
+                "[-m mode] [-e] [-d] [-p params.txt] [-a fast|slow|any|none] "
+                "[-k count] [-c checkpoint_s] [-n checkpoints] [-W lead_ms] "
+                "[-T from_ms] [-v]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (seconds <= 0 || stop_count <= 0 || checkpoint_s <= 0 || ring_size <= 0) {
+        fprintf(stderr, "-t, -k, -c and -n must be positive\n");
+        return 1;
+    }
+    
+    PairState s;
+    init(&s, seed, profile, mode);
+    Checkpoints checkpoints((size_t) ring_size);
+    uint64_t end = (uint64_t) seconds * 1000;
+    uint64_t next_checkpoint = 0;
+    long long stops_seen = 0;
+    Event last = EV_NONE;
+    std::chrono::steady_clock::time_point wall0 = std::chrono::steady_clock::now();
+    while (s.now < end) {
+        // Checkpoints fall between events, so a rerun starts cleanly
+        if (s.now >= next_checkpoint) {
+            checkpoints.take(s);
+            next_checkpoint = s.now - s.now % (checkpoint_s * 1000) + checkpoint_s * 1000;
+        }
+        last = step(&s);
+        if (verbose) trace(s, last);
+        if (stops(stop_on, last) && ++stops_seen == stop_count) break;
+    }
+    double run_wall = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - wall0).count();
+    
+    char when[32];
+    format_time(s.now, when, sizeof(when));
+    bool stopped = stops(stop_on, last) && stops_seen == stop_count;
+    printf("%s at %s after %llu events, %.3f s wall\n",
+        stopped ? event_name[last] : "end", when,
+        (unsigned long long) s.events, run_wall);
+    printf("AP %llu VP %llu | AS %llu/%llu VS %llu/%llu accepted | "
+        "alarms fast %llu slow %llu\n",
+        (unsigned long long) s.ap, (unsigned long long) s.vp,
+        (unsigned long long) s.as_accepted, (unsigned long long) s.as_seen,
+        (unsigned long long) s.vs_accepted, (unsigned long long) s.vs_seen,
+        (unsigned long long) s.alarms_fast, (unsigned long long) s.alarms_slow);
+    if (verbose || (!stopped && from_ms < 0)) return stopped ? 2 : 0;
+    
+    // Rewind and rerun the lead-up with every event printed
+    uint64_t target = s.now;
+    uint64_t target_events = s.events;
+    uint64_t target_hash = state_hash(s);
+    uint64_t from = from_ms >= 0 ? (uint64_t) from_ms :
+        target > (uint64_t) lead_ms ? target - lead_ms : 0;
+    const PairState *c = checkpoints.before(from);
+    // Virtual time starts past 0, so from may precede the run itself; the
+    // first checkpoint covers that unless it was overwritten
+    if (c == NULL && !checkpoints.overwritten) c = &checkpoints.oldest();
+    if (c == NULL) {
+        format_time(checkpoints.oldest().now, when, sizeof(when));
+        fprintf(stderr, "oldest checkpoint is at %s; use a larger -n or -c\n", when);
+        return 1;
+    }
+    PairState r = *c;
+    format_time(r.now, when, sizeof(when));
+    printf("rewound to checkpoint at %s, event %llu\n", when,
+        (unsigned long long) r.events);
+    wall0 = std::chrono::steady_clock::now();
+    uint64_t until = from_ms >= 0 && !stopped ? from + lead_ms : target;
+    while (r.events < target_events && r.now < until) {
+        Event ev = step(&r);
+        if (r.now >= from) trace(r, ev);
+    }
+    double replay_wall = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - wall0).count();
+    if (r.events == target_events) {
+        bool same = state_hash(r) == target_hash;
+        printf("rerun reached event %llu in %.6f s wall, state %s\n",
+            (unsigned long long) r.events, replay_wall,
+            same ? "identical" : "DIFFERS");
+        if (!same) return 3;
+    }
+    return stopped ? 2 : 0;
+}
@@ -0,0 +1,50 @@
+// Throughput and summary statistics for each rhythm profile.
+//
+// Build and run from this directory:
+//   g++ -O3 -march=native -std=c++11 -I.. rhythm_bench.cpp ../rhythm.cpp -o rhythm_bench
+//   ./rhythm_bench [events] [seed]
+
+#include "rhythm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+
+#define BATCH 4096
+
+int main(int argc, char **argv) {
+    long long events = argc > 1 ? atoll(argv[1]) : 50000000;
+    uint64_t seed = argc > 2 ? strtoull(argv[2], NULL, 0) : 1;
+    std::vector<Beat> beats(BATCH);
+    
+    printf("%-9s %12s %8s %8s %10s %10s\n",
+        "profile", "events/s", "A", "V", "mean V-V", "mean BPM");
+    for (int p = 0; p < RHYTHM_COUNT; p++) {
+        Rhythm rhythm((RhythmProfile) p, seed);
+        long long a = 0, v = 0;
+        long long t = 0, first_v = -1, last_v = 0;
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        for (long long done = 0; done < events; done += BATCH) {
+            rhythm.fill(&beats[0], BATCH);
+            for (int i = 0; i < BATCH; i++) {
+                t += beats[i].interval;
+                if (beats[i].chamber == RHYTHM_A) {
+                    a++;
+                } else {
+                    v++;
+                    if (first_v < 0) first_v = t;
+                    last_v = t;
+                }
+            }
+        }
+        double elapsed = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+        double vv = v > 1 ? (double) (last_v - first_v) / (double) (v - 1) : 0.0;
+        printf("%-9s %12.0f %8.3f %8.3f %10.1f %10.1f\n", rhythm_name[p],
+            (double) (a + v) / elapsed,
+            (double) a / (double) (a + v), (double) v / (double) (a + v),
+            vv, vv > 0 ? 60000.0 / vv : 0.0);
+    }
+    return 0;
+}
@@ -0,0 +1,110 @@
+#!/bin/sh
+# Flash/RAM footprint gate against size_budget.txt.
+#
+#   size_report.sh [-m headroom_pct] build_dir [budget_file]
+#
+# The images it checks come from either build of a board:
+#
+#   Online compiler: the downloaded Heart_LPC1768*.bin or
+#   Pacemaker_LPC1768*.bin, checked for flash only, e.g. from the
+#   repository root after saving the image there:
+#     host/size_report.sh .
+#
+#   GCC_ARM: export the board's program and build it, which leaves the
+#   .elf and one .o per module under BUILD/:
+#     mbed export -i GCC_ARM -m LPC1768
+#     make
+#     ../host/size_report.sh BUILD
+#   To gate every build, make that line the last command of the exported
+#   Makefile's all target.
+#
+# Prints text/data/bss per entry of the budget file found in build_dir
+# and exits non-zero if any of them is over its budget. Entries with no
+# matching file are skipped.
+#
+# With -m it checks nothing and instead prints a budget file for every
+# image and object in build_dir, each figure raised by headroom_pct
+# percent, to re-baseline:
+#   host/size_report.sh -m 5 BUILD > host/size_budget.txt
+
+HEADROOM=
+if [ "$1" = "-m" ]; then
+    HEADROOM=${2:?usage: size_report.sh [-m headroom_pct] build_dir [budget_file]}
+    shift 2
+fi
+BUILD=${1:?usage: size_report.sh [-m headroom_pct] build_dir [budget_file]}
+BUDGET=${2:-$(dirname "$0")/size_budget.txt}
+SIZE=${SIZE:-arm-none-eabi-size}
+
+report=$(mktemp)
+trap 'rm -f "$report"' EXIT
+
+# text data bss of one file; a raw image is all flash and says nothing
+# about RAM
+sizes() {
+    case "$1" in
+        *.bin) echo "$(wc -c < "$1") 0 -" ;;
+        *)     $SIZE -B "$1" | awk 'NR == 2 { print $1, $2, $3 }' ;;
+    esac
+}
+
+# Entries to report: the budget file's, or with -m whatever was built
+entries() {
+    if [ -n "$HEADROOM" ]; then
+        # Downloads are numbered, Heart_LPC1768 (12).bin; the pattern
+        # matches the latest
+        find "$BUILD" -name '*_LPC1768*.bin' | while read f; do
+            f=$(basename "$f"); echo "${f%%_LPC1768*}_LPC1768*.bin - -"
+        done | sort -u
+        find "$BUILD" -name '*.elf' | while read f; do
+            echo "$(basename "$f") - -"
+        done | sort -u
+        find "$BUILD" -name '*.o' | while read f; do
+            echo "$(basename "$f" .o) - -"
+        done | sort -u
+    else
+        grep -v '^#' "$BUDGET"
+    fi
+}
+
+entries | while read name flash_max ram_max; do
+    [ -z "$name" ] && continue
+    case "$name" in
+        *.elf|*.bin) file=$(find "$BUILD" -name "$name" -exec ls -t {} + | head -n 1) ;;
+        *)           file=$(find "$BUILD" -name "$name.o" | head -n 1) ;;
+    esac
+    [ -z "$file" ] && continue
+    sizes "$file" | awk -v name="$name" -v fmax="$flash_max" \
+        -v rmax="$ram_max" -v headroom="$HEADROOM" '{
+        flash = $1 + $2; ram = $3 == "-" ? "-" : $2 + $3
+        if (headroom != "") {
+            grow = 1 + headroom / 100
+            printf("%-24s %7d %7s\n", name, int(flash * grow + 0.5),
+                ram == "-" ? "-" : int(ram * grow + 0.5))
+            next
+        }
+        over = ""
+        if (flash > fmax) over = over " flash"
+        if (ram != "-" && rmax != "-" && ram > rmax) over = over " ram"
+        line = sprintf("%-24s %8d %8d %8s %8d/%-8d %6s/%-6s  %s", name,
+            $1, $2, $3, flash, fmax, ram, rmax, over == "" ? "" : "OVER:" over)
+        sub(/ +$/, "", line)
+        print line
+    }'
+done > "$report"
+
+if [ -n "$HEADROOM" ]; then
+    echo "# Flash and RAM budgets in bytes, checked by size_report.sh."
+    echo "# Measured from $BUILD plus $HEADROOM% by size_report.sh -m."
+    echo "#"
+    printf '%-24s %7s %7s\n' "# name" flash ram
+    cat "$report"
+    exit 0
+fi
+
+printf '%-24s %8s %8s %8s %17s %13s\n' name text data bss flash/budget ram/budget
+cat "$report"
+if grep -q OVER "$report"; then
+    echo "size budget exceeded" >&2
+    exit 1
+fi
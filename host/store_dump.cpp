@@ -0,0 +1,169 @@
+// Read, or fill for testing, an image of the heart board's log flash
+// (logstore.h). An image is the raw flash contents, as read out with a
+// programmer.
+//
+// Build and run from this directory:
+//   g++ -O2 -std=c++11 -I.. store_dump.cpp ../logstore.cpp ../logz.cpp ../telemetry.cpp -o store_dump
+//   ./store_dump [-l] [-r] [-f from_ms] [-t to_ms] flash.bin > log.txt
+//   ./store_dump -w log.txt [-s size_kb] [-k programs] flash.bin
+//
+// Reading prints the log text from -f to -t, found through the sector
+// index, -r record headers instead and -l the sector table with erase
+// counts. -w appends a text log the way Logger does, 2 KB blocks packed
+// with logz, each stamped with the last "t - <ms>" it holds; the image is
+// created erased when missing. -k cuts the power after that many page
+// programs, to check that the next mount recovers. -e and -p set the
+// erase and program sizes, 4096 and 256 by default.
+
+#include "logstore.h"
+#include "logz.h"
+#include "file_device.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-l] [-r] [-f from_ms] [-t to_ms] flash.bin\n"
+        "       %s -w log.txt [-s size_kb] [-k programs] flash.bin\n",
+        name, name);
+}
+
+// Trailing number of the last line in a block, the event time
+static bool block_time(const uint8_t *b, int n, uint32_t *t) {
+    while (n > 0 && (b[n - 1] == '\n' || b[n - 1] == '\r' || b[n - 1] == ' ')) n--;
+    int e = n;
+    while (n > 0 && b[n - 1] >= '0' && b[n - 1] <= '9') n--;
+    if (n == e || e - n > 9) return false;
+    uint32_t v = 0;
+    for (int i = n; i < e; i++) v = v * 10 + (b[i] - '0');
+    *t = v;
+    return true;
+}
+
+static int fill(LogStore *store, FileBlockDevice *dev, const char *path) {
+    FILE *in = fopen(path, "r");
+    if (in == NULL) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    static LogzEncoder encoder;
+    static uint8_t block[LOGZ_BLOCK];
+    static uint8_t packed[LOGZ_BLOCK + LOGZ_BLOCK_HEADER];
+    uint32_t time = store->last_time();
+    long blocks = 0, raw = 0, stored = 0;
+    int used = 0;
+    bool failed = false;
+    char line[LOGZ_BLOCK];
+    bool more = true;
+    while (more && !failed) {
+        more = fgets(line, sizeof(line), in) != NULL;
+        int n = more ? strlen(line) : 0;
+        if (used > 0 && (!more || used + n > LOGZ_BLOCK)) {
+            uint32_t t;
+            if (block_time(block, used, &t) && t > time) time = t;
+            int k = encoder.compress(block, used, packed);
+            failed = store->append(LOGSTORE_LOGZ, time, packed, k) != 0;
+            blocks++;
+            raw += used;
+            stored += k;
+            used = 0;
+        }
+        memcpy(&block[used], line, n);
+        used += n;
+    }
+    fclose(in);
+    if (!failed) failed = store->sync() != 0;
+    fprintf(stderr, "%ld blocks, %ld -> %ld bytes, %ld programs, %ld erases%s\n",
+        blocks, raw, stored, dev->programs, dev->erases,
+        failed ? ", power cut" : "");
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    bool list = false, records = false;
+    const char *write_path = NULL;
+    uint32_t from = 0, to = 0xFFFFFFFF;
+    uint32_t size_kb = 2048, erase = 4096, page = 256;
+    long cut = -1;
+    int opt;
+    while ((opt = getopt(argc, argv, "lrf:t:w:s:k:e:p:h")) != -1) {
+        switch (opt) {
+        case 'l': list = true; break;
+        case 'r': records = true; break;
+        case 'f': from = strtoul(optarg, NULL, 0); break;
+        case 't': to = strtoul(optarg, NULL, 0); break;
+        case 'w': write_path = optarg; break;
+        case 's': size_kb = strtoul(optarg, NULL, 0); break;
+        case 'k': cut = atol(optarg); break;
+        case 'e': erase = strtoul(optarg, NULL, 0); break;
+        case 'p': page = strtoul(optarg, NULL, 0); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    const char *image = argv[optind];
+    
+    FileBlockDevice dev(erase, page);
+    if (!dev.open_image(image, write_path != NULL, size_kb * 1024)) {
+        fprintf(stderr, "%s: cannot open image\n", image);
+        return 1;
+    }
+    LogStore store(&dev);
+    if (store.mount() != 0) {
+        fprintf(stderr, "%s: geometry not supported\n", image);
+        return 1;
+    }
+    if (write_path != NULL) {
+        dev.power_cut = cut;
+        return fill(&store, &dev, write_path);
+    }
+    
+    if (list) {
+        printf("sector sequence erases first_ms\n");
+        for (int i = 0; i < store.sectors(); i++) {
+            LogStoreSector s;
+            if (store.sector(i, &s)) {
+                printf("%6d %8u %6u %u\n", i, s.sequence, s.erase_count,
+                    s.first_time);
+            }
+        }
+        printf("%d of %u sectors used, last record at %u ms\n",
+            store.sectors(), dev.size() / dev.erase_size(), store.last_time());
+        return 0;
+    }
+    
+    LogStoreCursor c;
+    store.seek(from, &c);
+    std::vector<uint8_t> payload(store.max_record());
+    static uint8_t text[LOGZ_BLOCK];
+    LogStoreRecord r;
+    int n;
+    while ((n = store.next(&c, &r, payload.data(), payload.size())) >= 0 &&
+            r.time <= to) {
+        if (records) {
+            printf("%u ms type %d, %d bytes, sector %d\n", r.time, r.type, n,
+                c.index);
+        } else if (r.type == LOGSTORE_TEXT) {
+            fwrite(payload.data(), 1, n, stdout);
+        } else if (r.type == LOGSTORE_LOGZ && n >= LOGZ_BLOCK_HEADER) {
+            int raw = payload[0] | payload[1] << 8;
+            int packed = payload[2] | payload[3] << 8;
+            if (raw > LOGZ_BLOCK || (packed & ~LOGZ_STORED) > n - LOGZ_BLOCK_HEADER ||
+                    logz_decompress(&payload[LOGZ_BLOCK_HEADER], packed, text,
+                        raw) != raw) {
+                fprintf(stderr, "record at %u ms: corrupt block\n", r.time);
+                continue;
+            }
+            fwrite(text, 1, raw, stdout);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,120 @@
+// Decode the heart board's telemetry stream (press 'b' on the console to
+// switch it on) from a serial device or a capture file.
+//
+// Build and run from this directory:
+//   g++ -O2 -std=c++11 -I.. telemetry_dump.cpp ../telemetry.cpp -o telemetry_dump
+//   ./telemetry_dump /dev/ttyACM0        # or a file, or - for stdin
+//
+// Console frames are printed as text, other frames one per line. Frame,
+// loss and corruption counts are printed at the end of input and on
+// Ctrl-C.
+
+#include "telemetry.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+// Event bits as sent by heart.cpp
+#define AP 0x01
+#define AS 0x02
+#define VP 0x04
+#define VS 0x08
+
+static volatile sig_atomic_t stop = 0;
+
+static void on_signal(int) {
+    stop = 1;
+}
+
+static const char *event_name(int e) {
+    switch (e) {
+    case AP: return "AP";
+    case AS: return "AS";
+    case VP: return "VP";
+    case VS: return "VS";
+    default: return "??";
+    }
+}
+
+static void print_frame(const TelemetryFrame &f) {
+    switch (f.type) {
+    case FRAME_CONSOLE:
+        fwrite(f.payload, 1, f.length, stdout);
+        break;
+    case FRAME_EVENT:
+        if (f.length >= 5) {
+            printf("[event] t=%u %s\n", get_u32(f.payload + 1),
+                event_name(f.payload[0]));
+        }
+        break;
+    case FRAME_STATS:
+        if (f.length >= 8) {
+            unsigned bpm10 = get_u16(f.payload);
+            printf("[stats] %u.%u BPM, %u beats in %u ms\n", bpm10 / 10,
+                bpm10 % 10, get_u16(f.payload + 2), get_u32(f.payload + 4));
+        }
+        break;
+    case FRAME_VERDICT:
+        if (f.length >= 4) {
+            printf("[verdict] #%u mode %u %s\n", get_u16(f.payload + 2),
+                f.payload[1], f.payload[0] ? "passed" : "failed");
+        }
+        break;
+    case FRAME_MARGIN:
+        if (f.length >= 17) {
+            int32_t margin = (int32_t) get_u32(f.payload + 13);
+            printf("[margin] mode %u assert %u.%u %s window %d us",
+                f.payload[0], f.payload[1] + 1, f.payload[2] + 1,
+                f.payload[3] ? event_name(f.payload[3]) : "quiet",
+                (int32_t) get_u32(f.payload + 5));
+            if (f.payload[4]) {
+                printf(" observed %d us", (int32_t) get_u32(f.payload + 9));
+            } else {
+                printf(" nothing came");
+            }
+            if (margin != INT32_MIN) printf(" margin %d us", margin);
+            printf("\n");
+        }
+        break;
+    default:
+        printf("[type %u] %d bytes\n", f.type, f.length);
+        break;
+    }
+}
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : "-";
+    int fd = strcmp(path, "-") == 0 ? 0 : open(path, O_RDONLY | O_NOCTTY);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    if (isatty(fd)) {
+        struct termios tio;
+        tcgetattr(fd, &tio);
+        cfmakeraw(&tio);
+        cfsetispeed(&tio, B115200);
+        cfsetospeed(&tio, B115200);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+    signal(SIGINT, on_signal);
+    
+    TelemetryRx rx;
+    TelemetryFrame frame;
+    uint8_t buffer[4096];
+    while (!stop) {
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n <= 0) break;
+        for (ssize_t i = 0; i < n; i++) {
+            if (rx.feed(buffer[i], &frame)) print_frame(frame);
+        }
+        fflush(stdout);
+    }
+    fprintf(stderr, "\nframes %ld, lost %ld, corrupt %ld\n", rx.frames,
+        rx.lost, rx.corrupt);
+    return 0;
+}
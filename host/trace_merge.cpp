@@ -0,0 +1,406 @@
+// Put a heart trace and a pacemaker trace (recorder.h) on the heart's clock
+// and interleave them.
+//
+// Build and run from this directory:
+//   g++ -O2 -std=c++11 -I.. trace_merge.cpp -o trace_merge
+//   ./trace_merge [-w window_s] [-o merged.bin] [-v] heart.bin pace.bin
+//
+// Every pulse on the four wires is recorded by both boards, the sender
+// stamping it before the pin rises and the receiver in its interrupt, so
+// the traffic itself serves as sync pulses. As in NTP, the smallest
+// heart-to-pace difference in a window (AS/VS) is offset + latency and
+// the smallest pace-to-heart one (AP/VP) is latency - offset; half their
+// difference is the offset, half their sum bounds its error. A line
+// through the per-window offsets gives the drift.
+//
+// -o writes the heart's edges plus the pacemaker's as pin + TRACE_REMOTE;
+// -v prints the merged edges as text.
+
+#include "trace.h"
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+// Sender to receiver is taken to be at most this long
+#define LATENCY_US 2000
+// Gaps compared when finding the first common edge
+#define PATTERN 16
+#define GAP_SLACK_US 500
+// Crystal tolerance assumed before the drift is known, in ppm
+#define DRIFT_PPM 200
+
+static const char *pin_name[] = { "AP", "AS", "VP", "VS" };
+
+struct Trace {
+    const char *path;
+    TraceHeader header;
+    std::vector<TraceRecord> records;
+    // Rising edge times by pin
+    std::vector<uint64_t> rise[4];
+};
+
+struct Pair {
+    uint64_t heart;
+    uint64_t pace;
+    int pin;
+};
+
+// Clock model: pace = heart + offset + drift * (heart - origin)
+struct Sync {
+    double origin;
+    double offset;
+    double drift;
+    
+    double to_pace(double heart) const {
+        return heart + offset + drift * (heart - origin);
+    }
+    
+    double to_heart(double pace) const {
+        return origin + (pace - offset - origin) / (1 + drift);
+    }
+};
+
+static bool load(Trace *t) {
+    FILE *fp = fopen(t->path, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "%s: %s\n", t->path, strerror(errno));
+        return false;
+    }
+    if (fread(&t->header, sizeof(t->header), 1, fp) != 1 ||
+            t->header.magic != TRACE_MAGIC ||
+            t->header.header_size < sizeof(t->header) ||
+            fseek(fp, t->header.header_size, SEEK_SET) != 0) {
+        fprintf(stderr, "%s: not a trace file\n", t->path);
+        fclose(fp);
+        return false;
+    }
+    TraceRecord buf[512];
+    size_t n;
+    while ((n = fread(buf, sizeof(TraceRecord), 512, fp)) > 0) {
+        t->records.insert(t->records.end(), buf, buf + n);
+    }
+    fclose(fp);
+    for (size_t i = 0; i < t->records.size(); i++) {
+        int pin = trace_pin(t->records[i]);
+        if (pin <= TRACE_VS && trace_level(t->records[i]) == 1) {
+            t->rise[pin].push_back(trace_time(t->records[i]));
+        }
+    }
+    return true;
+}
+
+// Where the first PATTERN gaps of b recur in a, as an index into a, or -1
+static long find_pattern(const std::vector<uint64_t> &a,
+        const std::vector<uint64_t> &b) {
+    if (b.size() <= PATTERN || a.size() <= PATTERN) return -1;
+    for (size_t i = 0; i + PATTERN < a.size(); i++) {
+        int k = 0;
+        for (; k < PATTERN; k++) {
+            long long ga = (long long) (a[i + k + 1] - a[i + k]);
+            long long gb = (long long) (b[k + 1] - b[k]);
+            if (llabs(ga - gb) > GAP_SLACK_US) break;
+        }
+        if (k == PATTERN) return (long) i;
+    }
+    return -1;
+}
+
+// Pairs each heart edge with the nearest pacemaker edge on the same wire
+// to where sync predicts it, within slack plus drift_slack per us away from
+// the sync origin
+static std::vector<Pair> match(const Trace &heart, const Trace &pace,
+        const Sync &sync, double slack, double drift_slack) {
+    std::vector<Pair> pairs;
+    for (int pin = 0; pin <= TRACE_VS; pin++) {
+        const std::vector<uint64_t> &h = heart.rise[pin];
+        const std::vector<uint64_t> &p = pace.rise[pin];
+        // The sender stamps first, so the receiver is late by the latency
+        bool forward = pin == TRACE_AS || pin == TRACE_VS;
+        double centre = forward ? LATENCY_US / 2 : -LATENCY_US / 2;
+        size_t j = 0;
+        for (size_t i = 0; i < h.size(); i++) {
+            double want = sync.to_pace(h[i]) + centre;
+            double reach = LATENCY_US / 2 + slack +
+                drift_slack * fabs(h[i] - sync.origin);
+            while (j < p.size() && p[j] < want - reach) j++;
+            size_t k = j;
+            while (k + 1 < p.size() && p[k + 1] <= want + reach &&
+                    fabs(p[k + 1] - want) < fabs(p[k] - want)) {
+                k++;
+            }
+            if (k < p.size() && p[k] <= want + reach) {
+                Pair pair = { h[i], p[k], pin };
+                pairs.push_back(pair);
+                j = k + 1;
+            }
+        }
+    }
+    return pairs;
+}
+
+// Counts the pairs sync finds, to pick between candidate offsets
+static size_t score(const Trace &heart, const Trace &pace, const Sync &sync) {
+    return match(heart, pace, sync, GAP_SLACK_US, DRIFT_PPM * 1e-6).size();
+}
+
+static double median(std::vector<double> &v) {
+    std::nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+    return v[v.size() / 2];
+}
+
+struct Window {
+    double time;
+    double offset;
+    double round_trip;
+};
+
+// NTP-style offset per window, relative to sync so drift within a window
+// does not bias it, from the least delayed edge each way or from the
+// median ones when robust, for pairs that may include strays. Windows
+// without traffic both ways are skipped unless none have it, in which
+// case latency is taken as zero.
+static std::vector<Window> windows(const std::vector<Pair> &pairs,
+        const Sync &sync, double window_us, bool robust, bool *one_way) {
+    double start = pairs[0].heart;
+    for (size_t i = 0; i < pairs.size(); i++) {
+        start = std::min(start, (double) pairs[i].heart);
+    }
+    std::vector<std::vector<double> > fwd, rev;
+    for (size_t i = 0; i < pairs.size(); i++) {
+        size_t w = (size_t) ((pairs[i].heart - start) / window_us);
+        if (w >= fwd.size()) {
+            fwd.resize(w + 1);
+            rev.resize(w + 1);
+        }
+        double d = (double) pairs[i].pace - sync.to_pace(pairs[i].heart);
+        if (pairs[i].pin == TRACE_AS || pairs[i].pin == TRACE_VS) {
+            fwd[w].push_back(d);
+        } else {
+            rev[w].push_back(-d);
+        }
+    }
+    std::vector<Window> out;
+    bool both = false;
+    for (size_t w = 0; w < fwd.size(); w++) {
+        if (!fwd[w].empty() && !rev[w].empty()) both = true;
+    }
+    for (size_t w = 0; w < fwd.size(); w++) {
+        double f = fwd[w].empty() ? 0 : robust ? median(fwd[w]) :
+            *std::min_element(fwd[w].begin(), fwd[w].end());
+        double r = rev[w].empty() ? 0 : robust ? median(rev[w]) :
+            *std::min_element(rev[w].begin(), rev[w].end());
+        Window win;
+        win.time = start + (w + 0.5) * window_us;
+        if (!fwd[w].empty() && !rev[w].empty()) {
+            win.offset = (f - r) / 2;
+            win.round_trip = f + r;
+        } else if (!both && !fwd[w].empty()) {
+            win.offset = f;
+            win.round_trip = 0;
+        } else if (!both && !rev[w].empty()) {
+            win.offset = -r;
+            win.round_trip = 0;
+        } else {
+            continue;
+        }
+        out.push_back(win);
+    }
+    *one_way = !both;
+    return out;
+}
+
+// Least squares line through the window offsets
+static Sync fit(const std::vector<Window> &w) {
+    Sync sync;
+    double st = 0, so = 0;
+    for (size_t i = 0; i < w.size(); i++) {
+        st += w[i].time;
+        so += w[i].offset;
+    }
+    sync.origin = st / w.size();
+    sync.offset = so / w.size();
+    double stt = 0, sto = 0;
+    for (size_t i = 0; i < w.size(); i++) {
+        double dt = w[i].time - sync.origin;
+        stt += dt * dt;
+        sto += dt * (w[i].offset - sync.offset);
+    }
+    sync.drift = stt > 0 ? sto / stt : 0;
+    return sync;
+}
+
+int main(int argc, char **argv) {
+    double window_s = 10;
+    const char *out_path = NULL;
+    bool verbose = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "w:o:vh")) != -1) {
+        switch (opt) {
+        case 'w': window_s = atof(optarg); break;
+        case 'o': out_path = optarg; break;
+        case 'v': verbose = true; break;
+        default:
+            fprintf(stderr, "usage: %s [-w window_s] [-o merged.bin] [-v] "
+                "heart.bin pace.bin\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 2 || window_s <= 0) {
+        fprintf(stderr, "usage: %s [-w window_s] [-o merged.bin] [-v] "
+            "heart.bin pace.bin\n", argv[0]);
+        return 1;
+    }
+    Trace heart, pace;
+    heart.path = argv[optind];
+    pace.path = argv[optind + 1];
+    if (!load(&heart) || !load(&pace)) return 1;
+    if (heart.header.board == TRACE_BOARD_PACE &&
+            pace.header.board == TRACE_BOARD_HEART) {
+        std::swap(heart, pace);
+    }
+    
+    // Coarse offset: the first edges of one trace found in the other, on
+    // whichever wire gives the most pairs
+    Sync sync = { 0, 0, 0 };
+    size_t best = 0;
+    for (int pin = 0; pin <= TRACE_VS; pin++) {
+        const std::vector<uint64_t> &h = heart.rise[pin];
+        const std::vector<uint64_t> &p = pace.rise[pin];
+        long i = find_pattern(h, p);
+        long j = find_pattern(p, h);
+        double candidates[2] = {
+            i >= 0 ? (double) p[0] - (double) h[i] : NAN,
+            j >= 0 ? (double) p[j] - (double) h[0] : NAN
+        };
+        double anchors[2] = {
+            i >= 0 ? (double) h[i] : 0,
+            j >= 0 ? (double) h[0] : 0
+        };
+        for (int c = 0; c < 2; c++) {
+            if (isnan(candidates[c])) continue;
+            Sync s = { anchors[c], candidates[c], 0 };
+            size_t n = score(heart, pace, s);
+            if (n > best) {
+                best = n;
+                sync = s;
+            }
+        }
+    }
+    if (best == 0) {
+        fprintf(stderr, "no common edges: are these traces of the same run?\n");
+        return 2;
+    }
+    
+    // Refine: a robust estimate from the loose pairs first, then pair
+    // again against each estimate with the drift known
+    std::vector<Pair> pairs;
+    std::vector<Window> w;
+    Sync correction;
+    bool one_way = false;
+    for (int pass = 0; pass < 3; pass++) {
+        pairs = pass == 0 ?
+            match(heart, pace, sync, GAP_SLACK_US, DRIFT_PPM * 1e-6) :
+            match(heart, pace, sync, 100, 0);
+        w = windows(pairs, sync, window_s * 1e6, pass == 0, &one_way);
+        if (w.empty()) {
+            fprintf(stderr, "no pairs after refinement pass %d\n", pass + 1);
+            return 2;
+        }
+        // The line through the windows corrects the model they were taken
+        // against
+        correction = fit(w);
+        Sync next;
+        next.origin = correction.origin;
+        next.offset = sync.to_pace(next.origin) - next.origin + correction.offset;
+        next.drift = sync.drift + correction.drift;
+        sync = next;
+    }
+    
+    double residual = 0, bound = 0;
+    std::vector<double> trips;
+    for (size_t i = 0; i < w.size(); i++) {
+        double r = w[i].offset - correction.to_pace(w[i].time) + w[i].time;
+        residual += r * r;
+        trips.push_back(w[i].round_trip);
+    }
+    residual = sqrt(residual / w.size());
+    std::sort(trips.begin(), trips.end());
+    bound = trips[trips.size() / 2] / 2;
+    
+    printf("%s: %zu edges, %s: %zu edges, %zu paired in %zu windows\n",
+        heart.path, heart.records.size(), pace.path, pace.records.size(),
+        pairs.size(), w.size());
+    printf("pace clock = heart + %.1f us, drift %+.2f ppm\n",
+        sync.to_pace(0), sync.drift * 1e6);
+    if (one_way) {
+        printf("traffic one way only: latency taken as 0, error not bounded\n");
+    } else {
+        printf("alignment error +-%.1f us (median half round trip), "
+            "fit residual %.1f us rms\n", bound, residual);
+    }
+    
+    // Wire latency on the common clock, sender to receiver
+    for (int pin = 0; pin <= TRACE_VS; pin++) {
+        long long n = 0;
+        double sum = 0, lo = INFINITY, hi = -INFINITY;
+        for (size_t i = 0; i < pairs.size(); i++) {
+            if (pairs[i].pin != pin) continue;
+            double d = sync.to_heart(pairs[i].pace) - pairs[i].heart;
+            if (pin == TRACE_AP || pin == TRACE_VP) d = -d;
+            n++;
+            sum += d;
+            lo = std::min(lo, d);
+            hi = std::max(hi, d);
+        }
+        printf("%s %s->%s: %lld paired of %zu/%zu",
+            pin_name[pin], pin == TRACE_AS || pin == TRACE_VS ? "heart" : "pace",
+            pin == TRACE_AS || pin == TRACE_VS ? "pace" : "heart",
+            n, heart.rise[pin].size(), pace.rise[pin].size());
+        if (n > 0) {
+            printf(", latency min/avg/max %.1f/%.1f/%.1f us", lo, sum / n, hi);
+        }
+        printf("\n");
+    }
+    
+    if (out_path == NULL && !verbose) return 0;
+    std::vector<TraceRecord> merged(heart.records);
+    for (size_t i = 0; i < pace.records.size(); i++) {
+        TraceRecord r = pace.records[i];
+        double t = sync.to_heart(trace_time(r));
+        if (t < 0) continue;
+        merged.push_back(trace_pack((uint64_t) llround(t),
+            trace_pin(r) + TRACE_REMOTE, trace_level(r)));
+    }
+    std::stable_sort(merged.begin(), merged.end(),
+        [](TraceRecord a, TraceRecord b) { return trace_time(a) < trace_time(b); });
+    if (verbose) {
+        for (size_t i = 0; i < merged.size(); i++) {
+            int pin = trace_pin(merged[i]);
+            printf("%14.3f %-5s %s %d\n", trace_time(merged[i]) / 1000.0,
+                pin >= TRACE_REMOTE ? "pace" : "heart",
+                pin_name[pin & 3], trace_level(merged[i]));
+        }
+    }
+    if (out_path != NULL) {
+        FILE *fp = fopen(out_path, "wb");
+        if (fp == NULL) {
+            fprintf(stderr, "%s: %s\n", out_path, strerror(errno));
+            return 1;
+        }
+        TraceHeader header;
+        header.magic = TRACE_MAGIC;
+        header.version = TRACE_VERSION;
+        header.header_size = sizeof(header);
+        header.board = TRACE_BOARD_HEART | TRACE_BOARD_PACE;
+        header.reserved = 0;
+        fwrite(&header, sizeof(header), 1, fp);
+        fwrite(merged.data(), sizeof(TraceRecord), merged.size(), fp);
+        fclose(fp);
+    }
+    return 0;
+}
@@ -0,0 +1,254 @@
+// Replay an edge trace recorded by the heart board (recorder.h) through the
+// Pacing engine and compare its paces against the recorded AP/VP edges.
+//
+// Build and run from this directory:
+//   g++ -O2 -std=c++11 -I.. trace_replay.cpp ../pacing.cpp ../params.cpp ../format.cpp ../profile.cpp -o trace_replay
+//   ./trace_replay [-m normal|sleep|exercise] [-x speed] [-f from_ms]
+//                  [-t to_ms] [-e] [-d] [-p params.txt] [-P folded.txt]
+//                  [-v] trcNNN.bin
+//
+// The file is memory-mapped and never copied; -f/-t binary search the
+// record array. Without -x the replay runs as fast as possible, -x 1 runs
+// in real time. -e and -d turn on PVARP extension and dynamic AVI as the
+// 'x' and 'd' keys do on the pacemaker, -p loads a parameter file saved
+// with psave; -v prints every event. Built with -DPROFILE, -P writes the
+// Pacing probes as folded stacks for flamegraph.pl and their table to
+// stderr.
+
+#include "trace.h"
+#include "pacing.h"
+#include "profile.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <thread>
+
+// A simulated pace matches a recorded one within this many us
+#define MATCH_US 2000
+
+static const char *pin_name[] = { "AP", "AS", "VP", "VS" };
+
+struct Matcher {
+    std::deque<uint64_t> recorded, simulated;
+    long long matched, missing, extra;
+    
+    Matcher() : matched(0), missing(0), extra(0) {}
+    
+    // Retire everything older than now - MATCH_US
+    void settle(uint64_t now) {
+        while (!recorded.empty() || !simulated.empty()) {
+            if (!recorded.empty() && !simulated.empty()) {
+                uint64_t r = recorded.front(), s = simulated.front();
+                uint64_t d = r > s ? r - s : s - r;
+                if (d <= MATCH_US) {
+                    matched++;
+                    recorded.pop_front();
+                    simulated.pop_front();
+                    continue;
+                }
+            }
+            uint64_t oldest = recorded.empty() ? simulated.front() :
+                simulated.empty() ? recorded.front() :
+                std::min(recorded.front(), simulated.front());
+            if (oldest + MATCH_US >= now) break;
+            if (!recorded.empty() && recorded.front() == oldest) {
+                missing++;
+                recorded.pop_front();
+            } else {
+                extra++;
+                simulated.pop_front();
+            }
+        }
+    }
+};
+
+static const TraceRecord *lower(const TraceRecord *b, const TraceRecord *e,
+        uint64_t t_us) {
+    return std::lower_bound(b, e, t_us,
+        [](TraceRecord r, uint64_t t) { return trace_time(r) < t; });
+}
+
+static FILE *profile_file;
+
+static void profile_out(const char *s, int n) {
+    for (int i = 0; i < n; i++) {
+        if (s[i] != '\r') fputc(s[i], profile_file);
+    }
+}
+
+int main(int argc, char **argv) {
+    Pacing pacing;
+    PaceParams params;
+    params_defaults(&params);
+    double speed = 0;
+    long long from_ms = -1, to_ms = -1;
+    bool verbose = false;
+    const char *profile_path = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "m:x:f:t:edp:P:vh")) != -1) {
+        switch (opt) {
+        case 'm':
+            if (strcmp(optarg, "normal") == 0) pacing.mode = NORMAL;
+            else if (strcmp(optarg, "sleep") == 0) pacing.mode = SLEEP;
+            else if (strcmp(optarg, "exercise") == 0) pacing.mode = EXERCISE;
+            else { fprintf(stderr, "unknown mode %s\n", optarg); return 1; }
+            break;
+        case 'x': speed = atof(optarg); break;
+        case 'f': from_ms = atoll(optarg); break;
+        case 't': to_ms = atoll(optarg); break;
+        case 'e': params.extend_pvarp = 1; break;
+        case 'd': params.dynamic_avi = 1; break;
+        case 'p':
+            if (params_load(&params, optarg) < 0) {
+                fprintf(stderr, "%s: %s\n", optarg, strerror(errno));
+                return 1;
+            }
+            break;
+        case 'P': profile_path = optarg; break;
+        case 'v': verbose = true; break;
+        default:
+            fprintf(stderr, "usage: %s [-m mode] [-x speed] [-f from_ms] "
+                "[-t to_ms] [-e] [-d] [-p params.txt] [-P folded.txt] [-v] "
+                "trace.bin\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "no trace file given\n");
+        return 1;
+    }
+    
+    int fd = open(argv[optind], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+    if ((size_t) st.st_size < sizeof(TraceHeader)) {
+        fprintf(stderr, "%s: too short\n", argv[optind]);
+        return 1;
+    }
+    const unsigned char *base = (const unsigned char *) mmap(NULL, st.st_size,
+        PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "%s: mmap: %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+    const TraceHeader *header = (const TraceHeader *) base;
+    if (header->magic != TRACE_MAGIC || header->header_size > st.st_size) {
+        fprintf(stderr, "%s: not a trace file\n", argv[optind]);
+        return 1;
+    }
+    const TraceRecord *begin = (const TraceRecord *) (base + header->header_size);
+    const TraceRecord *end = begin +
+        (st.st_size - header->header_size) / sizeof(TraceRecord);
+    if (from_ms >= 0) begin = lower(begin, end, from_ms * 1000);
+    if (to_ms >= 0) end = lower(begin, end, to_ms * 1000);
+    if (begin == end) {
+        fprintf(stderr, "no records in range\n");
+        return 1;
+    }
+    madvise((void *) base, st.st_size, MADV_SEQUENTIAL);
+    
+    uint64_t t0 = trace_time(*begin);
+    // Last accepted atrial/ventricular event, and the last time the
+    // pacing thread would have recomputed its deadline
+    uint64_t a_mark = t0, v_mark = t0, decided = t0;
+    long long sensed[4] = { 0, 0, 0, 0 }, accepted[4] = { 0, 0, 0, 0 };
+    Matcher match[4];
+    std::chrono::steady_clock::time_point wall0 = std::chrono::steady_clock::now();
+    
+    for (const TraceRecord *r = begin; r != end; r++) {
+        uint64_t t = trace_time(*r);
+        int pin = trace_pin(*r);
+        if (pin > TRACE_VS || trace_level(*r) != 1) continue;
+        if (speed > 0) {
+            std::this_thread::sleep_until(wall0 + std::chrono::microseconds(
+                (long long) ((t - t0) / speed)));
+        }
+        
+        // Paces due before this edge
+        while (true) {
+            int ca = (int) ((decided - a_mark) / 1000);
+            int cv = (int) ((decided - v_mark) / 1000);
+            uint64_t deadline = decided +
+                (uint64_t) pacing.next(params, ca, cv) * 1000;
+            if (deadline > t) break;
+            ca = (int) ((deadline - a_mark) / 1000);
+            cv = (int) ((deadline - v_mark) / 1000);
+            int p = pacing.pace(params, ca, cv) == PACE_VP ? TRACE_VP : TRACE_AP;
+            if (p == TRACE_VP) v_mark = deadline; else a_mark = deadline;
+            match[p].simulated.push_back(deadline);
+            decided = deadline;
+            if (verbose) {
+                printf("%12.3f %s simulated\n", (deadline - t0) / 1000.0,
+                    pin_name[p]);
+            }
+        }
+        
+        int ca = (int) ((t - a_mark) / 1000);
+        int cv = (int) ((t - v_mark) / 1000);
+        if (pin == TRACE_AS || pin == TRACE_VS) {
+            sensed[pin]++;
+            bool ok = pin == TRACE_AS ? pacing.sense_a(params, ca, cv) :
+                pacing.sense_v(params, ca, cv);
+            if (ok) {
+                accepted[pin]++;
+                if (pin == TRACE_AS) a_mark = t; else v_mark = t;
+            }
+            decided = t;
+            if (verbose) {
+                printf("%12.3f %s %s\n", (t - t0) / 1000.0, pin_name[pin],
+                    ok ? "accepted" : "ignored");
+            }
+        } else {
+            match[pin].recorded.push_back(t);
+            if (verbose) {
+                printf("%12.3f %s recorded\n", (t - t0) / 1000.0, pin_name[pin]);
+            }
+        }
+        match[TRACE_AP].settle(t);
+        match[TRACE_VP].settle(t);
+    }
+    match[TRACE_AP].settle(UINT64_MAX - MATCH_US);
+    match[TRACE_VP].settle(UINT64_MAX - MATCH_US);
+    
+    double elapsed = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - wall0).count();
+    double span = (trace_time(*(end - 1)) - t0) / 1e6;
+    printf("records %lld, trace span %.1f s, replayed in %.3f s (%.0fx)\n",
+        (long long) (end - begin), span, elapsed,
+        elapsed > 0 ? span / elapsed : 0.0);
+    printf("AS %lld/%lld accepted, VS %lld/%lld accepted\n",
+        accepted[TRACE_AS], sensed[TRACE_AS],
+        accepted[TRACE_VS], sensed[TRACE_VS]);
+    for (int p = TRACE_AP; p <= TRACE_VP; p += 2) {
+        printf("%s matched %lld, recorded only %lld, simulated only %lld\n",
+            pin_name[p], match[p].matched, match[p].missing, match[p].extra);
+    }
+    if (profile_path != NULL) {
+        profile_file = fopen(profile_path, "w");
+        if (profile_file == NULL) {
+            fprintf(stderr, "%s: %s\n", profile_path, strerror(errno));
+        } else {
+            profile_dump(profile_out, true);
+            fputc('\n', profile_file);
+            fclose(profile_file);
+        }
+        profile_file = stderr;
+        profile_dump(profile_out, false);
+        fputc('\n', stderr);
+    }
+    munmap((void *) base, st.st_size);
+    close(fd);
+    return match[TRACE_AP].missing + match[TRACE_AP].extra +
+        match[TRACE_VP].missing + match[TRACE_VP].extra ? 2 : 0;
+}
@@ -0,0 +1,42 @@
+#include "jitter.h"
+
+Jitter::Jitter() {
+    reset();
+}
+
+void Jitter::reset() {
+    for (int i = 0; i < JITTER_BINS; i++) {
+        bins[i] = 0;
+    }
+    count = 0;
+    misses = 0;
+    early = 0;
+    max_us = 0;
+}
+
+void Jitter::add(int late_us) {
+    if (late_us < 0) {
+        early++;
+        late_us = 0;
+    }
+    int bin = late_us / JITTER_BIN_US;
+    bins[bin < JITTER_BINS ? bin : JITTER_BINS - 1]++;
+    if (late_us > JITTER_DEADLINE_US) {
+        misses++;
+    }
+    if (late_us > max_us) {
+        max_us = late_us;
+    }
+    count++;
+}
+
+int Jitter::percentile(int q) {
+    uint32_t seen = 0;
+    for (int i = 0; i < JITTER_BINS && count > 0; i++) {
+        seen += bins[i];
+        if ((uint64_t) seen * 100 >= (uint64_t) count * q) {
+            return (i + 1) * JITTER_BIN_US;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,34 @@
+#ifndef JITTER_H
+#define JITTER_H
+
+#include <stdint.h>
+
+// Lateness histogram, JITTER_BIN_US wide bins; the last one also
+// collects everything beyond it
+#define JITTER_BINS 16
+#define JITTER_BIN_US 100
+// Paces later than this count as deadline misses
+#define JITTER_DEADLINE_US 1000
+
+// Lateness of paces against the deadline the pacing thread computed
+class Jitter {
+    public:
+    uint32_t bins[JITTER_BINS];
+    uint32_t count;
+    uint32_t misses;
+    // Emitted before the deadline, counted in bin 0
+    uint32_t early;
+    int max_us;
+    
+    Jitter();
+    
+    void reset();
+    
+    void add(int late_us);
+    
+    // Smallest lateness that q percent of the paces did not exceed, at
+    // bin resolution
+    int percentile(int q);
+};
+
+#endif
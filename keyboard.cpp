@@ -39,8 +39,30 @@ bool Keyboard::command_complete() {
             (command[0] == 'o' || 
             command[0] == 'O' ||
             command[0] == 'h' ||
-			command[0] == 'H'
+			command[0] == 'H' ||
+			command[0] == 'p' ||
+			command[0] == 'P' ||
+			command[0] == 'y' ||
+			command[0] == 'Y' ||
+			command[0] == 'f' ||
+			command[0] == 'F' ||
+			command[0] == 'c' ||
+			command[0] == 'C' ||
+			command[0] == 'g' ||
+			command[0] == 'G' ||
+			command[0] == 'k' ||
+			command[0] == 'K' ||
+			command[0] == 'i' ||
+			command[0] == 'I'
             )
         )
     );
+}
+
+int Keyboard::read_number(int start) {
+    int value = 0;
+    for (int i = start; i < 20 && command[i] >= '0' && command[i] <= '9'; i++) {
+        value = value * 10 + (command[i] - '0');
+    }
+    return value;
 }
\ No newline at end of file
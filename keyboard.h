@@ -24,6 +24,9 @@ class Keyboard {
     void read_char(char c);
     
     bool command_complete();
+    
+    // Decimal number from the digits starting at command[start]
+    int read_number(int start);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,34 @@
+#include "leds.h"
+
+#define BLINK_MS 100
+
+DigitalOut ap_led(LED1);
+DigitalOut as_led(LED2);
+DigitalOut vp_led(LED3);
+DigitalOut vs_led(LED4);
+
+Thread * led_addr;
+
+void led_thread(void const * args) {
+    while (true) {
+        osEvent sig = Thread::signal_wait(0x00);
+        int signum = sig.value.signals;
+        if (signum & AP) {
+            ap_led = 1;
+            Thread::wait(BLINK_MS);
+            ap_led = 0;
+        } else if (signum & AS) {
+            as_led = 1;
+            Thread::wait(BLINK_MS);
+            as_led = 0;
+        } else if (signum & VP) {
+            vp_led = 1;
+            Thread::wait(BLINK_MS);
+            vp_led = 0;
+        } else if (signum & VS) {
+            vs_led = 1;
+            Thread::wait(BLINK_MS);
+            vs_led = 0;
+        }
+    }
+}
@@ -0,0 +1,13 @@
+#ifndef LEDS_H
+#define LEDS_H
+
+#include "mbed.h"
+#include "rtos.h"
+#include "signals.h"
+
+// Blinks LED1-4 for AP, AS, VP and VS signals
+extern Thread * led_addr;
+
+void led_thread(void const * args);
+
+#endif
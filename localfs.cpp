@@ -0,0 +1,3 @@
+#include "localfs.h"
+
+LocalFileSystem local("local");
@@ -0,0 +1,12 @@
+#ifndef LOCALFS_H
+#define LOCALFS_H
+
+#include "mbed.h"
+
+// The mbed's own flash drive, mounted at /local before main() runs.
+// Logs, traces, console scripts and the pacemaker's parameters all live
+// there, so each board links this rather than relying on another module
+// to mount it.
+extern LocalFileSystem local;
+
+#endif
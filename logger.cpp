@@ -1,33 +1,154 @@
 #include "logger.h"
-LocalFileSystem local("local");
+#include "rtos.h"
+#include "format.h"
+#include "profile.h"
+#include "localfs.h"
 
 int Logger::logfileno = 0;
 FILE* Logger::logfile = NULL;
+char Logger::buffer[LOG_BUFFER];
 
-void Logger::create_log_file(char *c) {
-    char filename[64];    
+bool Logger::compress = false;
+LogzEncoder Logger::encoder;
+uint8_t Logger::block[LOGZ_BLOCK];
+int Logger::block_used = 0;
+uint8_t Logger::packed[LOGZ_BLOCK + LOGZ_BLOCK_HEADER];
+
+LogStore *Logger::store = NULL;
+uint32_t Logger::store_base = 0;
+uint32_t Logger::last_ticks = 0;
+uint64_t Logger::elapsed_us = 0;
+
+// log() is called from the log thread and from the test threads
+static Mutex log_mutex;
+
+void Logger::use_store(LogStore *s) {
+    Logger::store = s;
+}
+
+// /local/logNNN.txt or .lgz
+static void log_filename(Format *f, int n, bool compress) {
+    f->clear();
+    *f << "/local/log" << pad(n, 3, '0') << (compress ? ".lgz" : ".txt");
+}
+
+void Logger::create_log_file(const char *c, bool compress) {
+    FormatBuffer<32> filename;
+    FormatLine line;
     int n = 0;
     
+    if (Logger::store != NULL) {
+        Logger::compress = true;
+        Logger::block_used = 0;
+        Logger::store_base = Logger::store->last_time() + 1;
+        Logger::last_ticks = us_ticker_read();
+        Logger::elapsed_us = 0;
+        log(line << c << ' ');
+        line.clear();
+        log(line << "Log at " << Logger::store_base << ' ');
+        return;
+    }
+    
+    // Numbers are shared between plain and compressed logs
     while(1) {
-        sprintf(filename, "/local/log%03d.txt", n);
-        FILE *fp = fopen(filename, "r");
+        log_filename(&filename, n, true);
+        FILE *fp = fopen(filename.c_str(), "r");
+        if(fp == NULL) {
+            log_filename(&filename, n, false);
+            fp = fopen(filename.c_str(), "r");
+        }
         if(fp == NULL) {
             break;
         }
         fclose(fp);
         n++;
     }
+    log_filename(&filename, n, compress);
     
     Logger::logfileno = n;
-    Logger::logfile = fopen(filename, "w");
-    fprintf(Logger::logfile, "%s \n",c);
-    fprintf(Logger::logfile, "Log #%d \n",n);
+    Logger::compress = compress;
+    Logger::block_used = 0;
+    Logger::logfile = fopen(filename.c_str(), compress ? "wb" : "w");
+    if (Logger::logfile == NULL) {
+        return;
+    }
+    setvbuf(Logger::logfile, Logger::buffer, _IOFBF, LOG_BUFFER);
+    if (compress) {
+        LogzHeader header;
+        header.magic = LOGZ_MAGIC;
+        header.version = LOGZ_VERSION;
+        header.block_size = LOGZ_BLOCK;
+        fwrite(&header, sizeof(header), 1, Logger::logfile);
+    }
+    log(line << c << ' ');
+    line.clear();
+    log(line << "Log #" << n << ' ');
 }
 
-void Logger::log(char *c) {
-    fprintf(Logger::logfile,"%s\n", c);
+void Logger::log(const Format &f) {
+    log(f.c_str());
+}
+
+void Logger::log(const char *c) {
+    PROFILE_SCOPE("log");
+    if (Logger::logfile == NULL && Logger::store == NULL) {
+        return;
+    }
+    log_mutex.lock();
+    if (!compress) {
+        fputs(c, Logger::logfile);
+        fputc('\n', Logger::logfile);
+    } else {
+        // A block only holds whole lines; longer ones are cut
+        int n = strlen(c);
+        if (n > LOGZ_BLOCK - 1) {
+            n = LOGZ_BLOCK - 1;
+        }
+        if (block_used + n + 1 > LOGZ_BLOCK) {
+            write_block();
+        }
+        memcpy(&block[block_used], c, n);
+        block[block_used + n] = '\n';
+        block_used += n + 1;
+    }
+    log_mutex.unlock();
+}
+
+void Logger::write_block() {
+    if (block_used == 0) {
+        return;
+    }
+    PROFILE_SCOPE("logz");
+    int n = encoder.compress(block, block_used, packed);
+    if (Logger::store != NULL) {
+        Logger::store->append(LOGSTORE_LOGZ, store_time(), packed, n);
+    } else {
+        fwrite(packed, 1, n, Logger::logfile);
+    }
+    block_used = 0;
+}
+
+// Called at least once a block, well inside the 71 minute wrap of the
+// microsecond ticker while the heart logs every beat
+uint32_t Logger::store_time() {
+    uint32_t t = us_ticker_read();
+    Logger::elapsed_us += t - Logger::last_ticks;
+    Logger::last_ticks = t;
+    return Logger::store_base + (uint32_t) (Logger::elapsed_us / 1000);
 }
 
 void Logger::close_log_file() {
-    fclose(Logger::logfile);    
+    log_mutex.lock();
+    if (Logger::store != NULL) {
+        write_block();
+        Logger::store->sync();
+        Logger::store = NULL;
+    } else if (Logger::logfile != NULL) {
+        if (compress) {
+            write_block();
+        }
+        fclose(Logger::logfile);    
+        Logger::logfile = NULL;
+    }
+    log_mutex.unlock();
 }
\ No newline at end of file
@@ -2,19 +2,49 @@
 #define LOGGER_H
 
 #include "mbed.h"
+#include "logz.h"
+#include "logstore.h"
+#include "format.h"
 
+// Static stdio buffer of the log file
+#define LOG_BUFFER 256
+
+// Writes /local/logNNN.txt, or with compress /local/logNNN.lgz: lines are
+// gathered into LOGZ_BLOCK sized blocks and each one is packed with logz
+// before it is written. host/log_unpack turns an .lgz back into text.
+//
+// With a LogStore given to use_store() first, the packed blocks go there
+// instead of /local, one record each, stamped with the store's time:
+// milliseconds continuing from its newest record. host/store_dump reads
+// them back.
 class Logger {
     public:
         
-    static void log(char *c);
-    static void create_log_file(char *c);
+    static void log(const char *c);
+    static void log(const Format &f);
+    static void use_store(LogStore *s);
+    static void create_log_file(const char *c, bool compress = false);
     static void close_log_file();
     
     private:
     
     static int logfileno;
     static FILE *logfile;
+    static char buffer[LOG_BUFFER];
+    
+    static bool compress;
+    static LogzEncoder encoder;
+    static uint8_t block[LOGZ_BLOCK];
+    static int block_used;
+    static uint8_t packed[LOGZ_BLOCK + LOGZ_BLOCK_HEADER];
+    
+    static LogStore *store;
+    static uint32_t store_base;
+    static uint32_t last_ticks;
+    static uint64_t elapsed_us;
     
+    static void write_block();
+    static uint32_t store_time();
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,276 @@
+#include "logstore.h"
+#include "telemetry.h"
+#include <string.h>
+
+#define ERASED_LENGTH 0xFFFF
+
+LogStore::LogStore(BlockDevice *_dev) : dev(_dev), sector_size(0),
+    page_size(0), count(0), oldest(0), used(0), head(0), sequence(0),
+    latest(0), head_open(false), page_addr(0), fill(0) {}
+
+int LogStore::mount() {
+    sector_size = dev->erase_size();
+    page_size = dev->program_size();
+    if (page_size == 0 || page_size > LOGSTORE_PAGE_MAX ||
+            sector_size % page_size != 0 ||
+            sector_size <= LOGSTORE_SECTOR_HEADER + LOGSTORE_RECORD_HEADER) {
+        return -1;
+    }
+    count = dev->size() / sector_size;
+    if (count < 2) {
+        return -1;
+    }
+    
+    used = 0;
+    oldest = 0;
+    head = count - 1;
+    sequence = 0;
+    latest = 0;
+    head_open = false;
+    fill = 0;
+    uint32_t low = 0;
+    for (int s = 0; s < count; s++) {
+        LogStoreSector h;
+        if (!read_sector(s, &h)) continue;
+        if (used == 0 || h.sequence > sequence) {
+            head = s;
+            sequence = h.sequence;
+            latest = h.first_time;
+        }
+        if (used == 0 || h.sequence < low) {
+            oldest = s;
+            low = h.sequence;
+        }
+        used++;
+    }
+    if (used == 0) {
+        return 0;
+    }
+    
+    // Carry on after the last good record of the newest sector
+    uint32_t end = (head + 1) * sector_size;
+    uint32_t addr = head * sector_size + LOGSTORE_SECTOR_HEADER;
+    LogStoreRecord r;
+    while (scan(&addr, end, &r)) {
+        latest = r.time;
+        addr += LOGSTORE_RECORD_HEADER + r.length;
+    }
+    page_addr = (addr + page_size - 1) / page_size * page_size;
+    head_open = true;
+    return 0;
+}
+
+int LogStore::max_record() {
+    int n = sector_size - LOGSTORE_SECTOR_HEADER - LOGSTORE_RECORD_HEADER;
+    return n < ERASED_LENGTH ? n : ERASED_LENGTH - 1;
+}
+
+uint32_t LogStore::last_time() {
+    return latest;
+}
+
+int LogStore::sectors() {
+    return used;
+}
+
+bool LogStore::sector(int i, LogStoreSector *s) {
+    return i >= 0 && i < used && read_sector(physical(i), s);
+}
+
+int LogStore::append(int type, uint32_t time, const void *data, int n) {
+    if (n < 0 || n > max_record()) {
+        return -1;
+    }
+    uint32_t end = (head + 1) * sector_size;
+    if (!head_open ||
+            page_addr + fill + LOGSTORE_RECORD_HEADER + n > end) {
+        if (sync() != 0 || open_sector(time) != 0) {
+            return -1;
+        }
+    }
+    uint8_t h[LOGSTORE_RECORD_HEADER];
+    put_u16(h, (uint16_t) n);
+    h[2] = (uint8_t) type;
+    h[3] = 0;
+    put_u32(h + 4, time);
+    uint16_t crc = crc16(h, 8);
+    put_u16(h + 8, crc16((const uint8_t *) data, n, crc));
+    if (put(h, sizeof(h)) != 0 || put((const uint8_t *) data, n) != 0) {
+        return -1;
+    }
+    latest = time;
+    return 0;
+}
+
+int LogStore::sync() {
+    if (fill == 0) {
+        return 0;
+    }
+    memset(&page[fill], 0xFF, page_size - fill);
+    int rc = dev->program(page_addr, page, page_size);
+    page_addr += page_size;
+    fill = 0;
+    return rc;
+}
+
+void LogStore::rewind(LogStoreCursor *c) {
+    c->index = 0;
+    c->addr = physical(0) * sector_size + LOGSTORE_SECTOR_HEADER;
+}
+
+void LogStore::seek(uint32_t time, LogStoreCursor *c) {
+    // First sector that starts after time; the record is in the one before
+    int lo = 0, hi = used;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        LogStoreSector h;
+        if (sector(mid, &h) && h.first_time <= time) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    c->index = lo > 0 ? lo - 1 : 0;
+    c->addr = physical(c->index) * sector_size + LOGSTORE_SECTOR_HEADER;
+    while (c->index < used) {
+        uint32_t addr = c->addr;
+        uint32_t end = (physical(c->index) + 1) * sector_size;
+        LogStoreRecord r;
+        if (!scan(&addr, end, &r)) {
+            c->index++;
+            c->addr = physical(c->index) * sector_size + LOGSTORE_SECTOR_HEADER;
+            continue;
+        }
+        if (r.time >= time) {
+            c->addr = addr;
+            return;
+        }
+        c->addr = addr + LOGSTORE_RECORD_HEADER + r.length;
+    }
+}
+
+int LogStore::next(LogStoreCursor *c, LogStoreRecord *r, void *data, int max) {
+    while (c->index < used) {
+        uint32_t addr = c->addr;
+        uint32_t end = (physical(c->index) + 1) * sector_size;
+        if (scan(&addr, end, r)) {
+            int n = r->length < max ? r->length : max;
+            if (dev->read(addr + LOGSTORE_RECORD_HEADER, data, n) != 0) {
+                return -1;
+            }
+            c->addr = addr + LOGSTORE_RECORD_HEADER + r->length;
+            return r->length;
+        }
+        c->index++;
+        c->addr = physical(c->index) * sector_size + LOGSTORE_SECTOR_HEADER;
+    }
+    return -1;
+}
+
+bool LogStore::read_sector(int s, LogStoreSector *h) {
+    uint8_t b[LOGSTORE_SECTOR_HEADER];
+    if (dev->read(s * sector_size, b, sizeof(b)) != 0 ||
+            get_u32(b) != LOGSTORE_MAGIC || crc16(b, 16) != get_u16(b + 16)) {
+        return false;
+    }
+    h->sequence = get_u32(b + 4);
+    h->erase_count = get_u32(b + 8);
+    h->first_time = get_u32(b + 12);
+    return true;
+}
+
+// Find the first intact record at or after *addr in the sector ending at
+// end and leave *addr on it. Returns false at the end of the records.
+// Erased space at a page start is the end; elsewhere it is padding, and
+// a record failing its CRC was torn, so both are skipped to the next page.
+bool LogStore::scan(uint32_t *addr, uint32_t end, LogStoreRecord *r) {
+    while (*addr + LOGSTORE_RECORD_HEADER <= end) {
+        uint8_t h[LOGSTORE_RECORD_HEADER];
+        if (dev->read(*addr, h, sizeof(h)) != 0) {
+            return false;
+        }
+        int length = get_u16(h);
+        if (length == ERASED_LENGTH && *addr % page_size == 0) {
+            return false;
+        }
+        if (length != ERASED_LENGTH && length <= max_record() &&
+                *addr + LOGSTORE_RECORD_HEADER + length <= end) {
+            uint16_t crc = crc16(h, 8);
+            uint8_t chunk[32];
+            uint32_t p = *addr + LOGSTORE_RECORD_HEADER;
+            for (int left = length; left > 0; ) {
+                int k = left < (int) sizeof(chunk) ? left : sizeof(chunk);
+                if (dev->read(p, chunk, k) != 0) {
+                    return false;
+                }
+                crc = crc16(chunk, k, crc);
+                p += k;
+                left -= k;
+            }
+            if (crc == get_u16(h + 8)) {
+                r->length = length;
+                r->type = h[2];
+                r->time = get_u32(h + 4);
+                return true;
+            }
+        }
+        *addr = (*addr / page_size + 1) * page_size;
+    }
+    return false;
+}
+
+// Erase the sector after the head and start it, its header going out
+// with the first page
+int LogStore::open_sector(uint32_t time) {
+    int s = (head + 1) % count;
+    LogStoreSector old;
+    bool reused = read_sector(s, &old);
+    if (dev->erase(s * sector_size, sector_size) != 0) {
+        return -1;
+    }
+    if (reused) {
+        oldest = (s + 1) % count;
+    } else {
+        used++;
+    }
+    head = s;
+    sequence++;
+    head_open = true;
+    page_addr = s * sector_size;
+    fill = 0;
+    
+    uint8_t h[LOGSTORE_SECTOR_HEADER];
+    put_u32(h, LOGSTORE_MAGIC);
+    put_u32(h + 4, sequence);
+    put_u32(h + 8, reused ? old.erase_count + 1 : 1);
+    put_u32(h + 12, time);
+    put_u16(h + 16, crc16(h, 16));
+    put_u16(h + 18, 0);
+    return put(h, sizeof(h));
+}
+
+int LogStore::put(const uint8_t *data, int n) {
+    while (n > 0) {
+        int k = page_size - fill;
+        if (k > n) {
+            k = n;
+        }
+        memcpy(&page[fill], data, k);
+        fill += k;
+        data += k;
+        n -= k;
+        if (fill == (int) page_size) {
+            int rc = dev->program(page_addr, page, page_size);
+            page_addr += page_size;
+            fill = 0;
+            if (rc != 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int LogStore::physical(int index) {
+    return (oldest + index) % count;
+}
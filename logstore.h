@@ -0,0 +1,107 @@
+#ifndef LOGSTORE_H
+#define LOGSTORE_H
+
+#include <stdint.h>
+#include "blockdev.h"
+
+// Append-only record log on a BlockDevice, so logs survive without a PC
+// attached. Portable; the host tools read device images with it.
+//
+// Every erase unit is a sector that starts with a header carrying a
+// sequence number, its erase count and the time of its first record.
+// Sectors are filled in turn round the device, the oldest one erased
+// when the log wraps, so all of them wear alike. Records are gathered in
+// RAM and programmed a whole page at a time; each carries a CRC, so a
+// page torn by a power cut is found and skipped at the next mount. The
+// sector headers double as the index: seek() binary searches them by
+// time and then walks a single sector.
+//
+// Sector: magic, sequence, erase count, first time (u32 each), crc16,
+//         u16 0, then records
+// Record: u16 payload length, u8 type, u8 0, u32 time, crc16 over those
+//         and the payload, payload
+// A 0xFFFF length marks erased space: the end of the log at a page
+// start, padding left by sync() elsewhere.
+
+#define LOGSTORE_MAGIC 0x53474F4C
+#define LOGSTORE_SECTOR_HEADER 20
+#define LOGSTORE_RECORD_HEADER 10
+#define LOGSTORE_PAGE_MAX 256
+
+// Record types
+#define LOGSTORE_TEXT 1
+#define LOGSTORE_LOGZ 2     // One logz block, header included
+
+struct LogStoreSector {
+    uint32_t sequence;
+    uint32_t erase_count;
+    uint32_t first_time;
+};
+
+struct LogStoreRecord {
+    uint16_t length;
+    uint8_t type;
+    uint32_t time;
+};
+
+// Read position, from LogStore::rewind() or seek()
+struct LogStoreCursor {
+    int index;      // Sector, counted from the oldest
+    uint32_t addr;
+};
+
+class LogStore {
+    public:
+    
+    LogStore(BlockDevice *_dev);
+    
+    // Find the newest sector and the end of its records. Returns 0, or -1
+    // when the device geometry does not fit.
+    int mount();
+    
+    // Times should not go backwards; seek() relies on it. Returns 0, or -1
+    // when the record is too long or the device fails.
+    int append(int type, uint32_t time, const void *data, int n);
+    // Program the page being gathered, padded. Records appended so far
+    // then survive a power cut.
+    int sync();
+    
+    int max_record();
+    // Time of the newest record, 0 for an empty log
+    uint32_t last_time();
+    // Sectors in use, and the header of the i-th oldest
+    int sectors();
+    bool sector(int i, LogStoreSector *s);
+    
+    // Reading sees what has been programmed, so sync() first
+    void rewind(LogStoreCursor *c);
+    // Position at the first record at or after time
+    void seek(uint32_t time, LogStoreCursor *c);
+    // Read the record at c into data (max bytes) and advance. Returns the
+    // payload length, or -1 at the end of the log.
+    int next(LogStoreCursor *c, LogStoreRecord *r, void *data, int max);
+    
+    private:
+    BlockDevice *dev;
+    uint32_t sector_size;
+    uint32_t page_size;
+    int count;          // Sectors on the device
+    int oldest;
+    int used;
+    int head;           // Sector being written
+    uint32_t sequence;  // Of the head
+    uint32_t latest;
+    bool head_open;     // Its header has been written
+    
+    uint32_t page_addr;
+    int fill;
+    uint8_t page[LOGSTORE_PAGE_MAX];
+    
+    bool read_sector(int s, LogStoreSector *h);
+    bool scan(uint32_t *addr, uint32_t end, LogStoreRecord *r);
+    int open_sector(uint32_t time);
+    int put(const uint8_t *data, int n);
+    int physical(int index);
+};
+
+#endif
@@ -0,0 +1,339 @@
+#include "logz.h"
+#include <string.h>
+
+// Range coder after LZMA: 11-bit probabilities, but adapting by 1/4 per
+// bit rather than 1/16, since a model only lives for one 2 KB block
+#define PROB_BITS 11
+#define PROB_INIT (1 << (PROB_BITS - 1))
+#define MOVE_BITS 2
+#define TOP (1u << 24)
+
+#define NUMBER_MARK 0x01
+#define NUMBER_DIGITS 9
+
+static void reset_probs(uint16_t *p, int n) {
+    for (int i = 0; i < n; i++) {
+        p[i] = PROB_INIT;
+    }
+}
+
+void LogzModel::reset() {
+    reset_probs(slot, sizeof(slot) / sizeof(slot[0]));
+    reset_probs(length, sizeof(length) / sizeof(length[0]));
+    reset_probs(literal, sizeof(literal) / sizeof(literal[0]));
+    reset_probs(&bits[0][0], sizeof(bits) / sizeof(bits[0][0]));
+    template_count = 0;
+}
+
+void LogzModel::promote(int i) {
+    if (i == 0) return;
+    LogzTemplate t = templates[i];
+    memmove(&templates[1], &templates[0], i * sizeof(LogzTemplate));
+    templates[0] = t;
+}
+
+LogzTemplate *LogzModel::insert() {
+    if (template_count < LOGZ_TEMPLATES) {
+        template_count++;
+    }
+    memmove(&templates[1], &templates[0],
+        (template_count - 1) * sizeof(LogzTemplate));
+    memset(&templates[0], 0, sizeof(LogzTemplate));
+    return &templates[0];
+}
+
+static uint32_t zigzag(uint32_t value, uint32_t last) {
+    int32_t d = (int32_t) (value - last);
+    return ((uint32_t) d << 1) ^ (uint32_t) (d >> 31);
+}
+
+static uint32_t unzigzag(uint32_t z, uint32_t last) {
+    return last + ((z >> 1) ^ (0u - (z & 1)));
+}
+
+static int bit_length(uint32_t v) {
+    int n = 0;
+    while (v) {
+        n++;
+        v >>= 1;
+    }
+    return n;
+}
+
+// Splits one line, or as much of it as fits a template, into its template
+// and numbers. Returns the bytes consumed, or -1 for text it cannot carry.
+static int tokenize(const uint8_t *in, int n, LogzTemplate *t, uint32_t *numbers) {
+    int i = 0;
+    t->length = 0;
+    t->fields = 0;
+    while (i < n) {
+        if (in[i] == NUMBER_MARK) return -1;
+        int run = 0;
+        while (i + run < n && in[i + run] >= '0' && in[i + run] <= '9') run++;
+        if (run > 0 && run <= NUMBER_DIGITS && (in[i] != '0' || run == 1) &&
+                t->fields < LOGZ_FIELDS) {
+            if (t->length == LOGZ_TEMPLATE_MAX) break;
+            uint32_t v = 0;
+            for (int k = 0; k < run; k++) v = v * 10 + (in[i + k] - '0');
+            numbers[t->fields++] = v;
+            t->text[t->length++] = NUMBER_MARK;
+            i += run;
+            continue;
+        }
+        // Digits that are not taken as a number stay in the text whole
+        int take = run > 0 ? run : 1;
+        if (t->length + take > LOGZ_TEMPLATE_MAX) break;
+        memcpy(&t->text[t->length], &in[i], take);
+        t->length += take;
+        i += take;
+        if (in[i - 1] == '\n') break;
+    }
+    return i > 0 ? i : -1;
+}
+
+int LogzEncoder::compress(const uint8_t *in, int n, uint8_t *block) {
+    out = block + LOGZ_BLOCK_HEADER;
+    out_pos = 0;
+    out_limit = n;
+    low = 0;
+    range = 0xFFFFFFFF;
+    cache = 0;
+    cache_size = 1;
+    model.reset();
+
+    bool ok = true;
+    int pos = 0;
+    while (ok && pos < n) {
+        LogzTemplate t;
+        uint32_t numbers[LOGZ_FIELDS];
+        int used = tokenize(in + pos, n - pos, &t, numbers);
+        if (used < 0) {
+            ok = false;
+            break;
+        }
+        int slot = 0;
+        while (slot < model.template_count &&
+            (model.templates[slot].length != t.length ||
+             memcmp(model.templates[slot].text, t.text, t.length) != 0)) {
+            slot++;
+        }
+        if (slot < model.template_count) {
+            tree(model.slot, 4, slot);
+            model.promote(slot);
+        } else {
+            tree(model.slot, 4, LOGZ_TEMPLATES);
+            tree(model.length, 6, t.length - 1);
+            for (int i = 0; i < t.length; i++) {
+                tree(model.literal, 8, t.text[i]);
+            }
+            LogzTemplate *fresh = model.insert();
+            memcpy(fresh->text, t.text, t.length);
+            fresh->length = t.length;
+            fresh->fields = t.fields;
+        }
+        LogzTemplate *current = &model.templates[0];
+        for (int f = 0; f < t.fields; f++) {
+            uint32_t z = zigzag(numbers[f], current->last[f]);
+            int nbits = bit_length(z);
+            tree(model.bits[f], 6, nbits);
+            if (nbits > 1) direct(z, nbits - 1);
+            current->last[f] = numbers[f];
+        }
+        pos += used;
+        ok = out_pos < out_limit;
+    }
+    if (ok) {
+        flush();
+        ok = out_pos < out_limit;
+    }
+
+    int packed = out_pos;
+    if (!ok) {
+        memcpy(out, in, n);
+        packed = n | LOGZ_STORED;
+    }
+    block[0] = n & 0xFF;
+    block[1] = n >> 8;
+    block[2] = packed & 0xFF;
+    block[3] = packed >> 8;
+    return LOGZ_BLOCK_HEADER + (packed & ~LOGZ_STORED);
+}
+
+void LogzEncoder::encode(uint16_t *p, int bit) {
+    uint32_t bound = (range >> PROB_BITS) * *p;
+    if (bit == 0) {
+        range = bound;
+        *p += ((1 << PROB_BITS) - *p) >> MOVE_BITS;
+    } else {
+        low += bound;
+        range -= bound;
+        *p -= *p >> MOVE_BITS;
+    }
+    while (range < TOP) {
+        range <<= 8;
+        shift_low();
+    }
+}
+
+// The low nbits of value at even odds
+void LogzEncoder::direct(uint32_t value, int nbits) {
+    for (int i = nbits - 1; i >= 0; i--) {
+        range >>= 1;
+        if ((value >> i) & 1) low += range;
+        while (range < TOP) {
+            range <<= 8;
+            shift_low();
+        }
+    }
+}
+
+void LogzEncoder::tree(uint16_t *probs, int nbits, int value) {
+    int m = 1;
+    for (int i = nbits - 1; i >= 0; i--) {
+        int bit = (value >> i) & 1;
+        encode(&probs[m], bit);
+        m = (m << 1) | bit;
+    }
+}
+
+void LogzEncoder::shift_low() {
+    if ((uint32_t) low < 0xFF000000u || (low >> 32) != 0) {
+        uint8_t carry = (uint8_t) (low >> 32);
+        uint8_t temp = cache;
+        do {
+            if (out_pos < out_limit) out[out_pos] = temp + carry;
+            out_pos++;
+            temp = 0xFF;
+        } while (--cache_size != 0);
+        cache = (uint8_t) (low >> 24);
+    }
+    cache_size++;
+    low = (low & 0x00FFFFFF) << 8;
+}
+
+void LogzEncoder::flush() {
+    for (int i = 0; i < 5; i++) {
+        shift_low();
+    }
+}
+
+class LogzDecoder {
+    public:
+    const uint8_t *in;
+    int n;
+    int pos;
+    uint32_t range;
+    uint32_t code;
+
+    LogzDecoder(const uint8_t *_in, int _n) : in(_in), n(_n), pos(0),
+        range(0xFFFFFFFF), code(0) {
+        for (int i = 0; i < 5; i++) {
+            code = (code << 8) | next();
+        }
+    }
+
+    uint8_t next() {
+        return pos < n ? in[pos++] : (pos++, 0);
+    }
+
+    bool overrun() const {
+        return pos > n + 4;
+    }
+
+    int decode(uint16_t *p) {
+        uint32_t bound = (range >> PROB_BITS) * *p;
+        int bit;
+        if (code < bound) {
+            range = bound;
+            *p += ((1 << PROB_BITS) - *p) >> MOVE_BITS;
+            bit = 0;
+        } else {
+            code -= bound;
+            range -= bound;
+            *p -= *p >> MOVE_BITS;
+            bit = 1;
+        }
+        while (range < TOP) {
+            range <<= 8;
+            code = (code << 8) | next();
+        }
+        return bit;
+    }
+
+    uint32_t direct(int nbits) {
+        uint32_t value = 0;
+        for (int i = 0; i < nbits; i++) {
+            range >>= 1;
+            int bit = code >= range;
+            if (bit) code -= range;
+            value = (value << 1) | bit;
+            while (range < TOP) {
+                range <<= 8;
+                code = (code << 8) | next();
+            }
+        }
+        return value;
+    }
+
+    int tree(uint16_t *probs, int nbits) {
+        int m = 1;
+        for (int i = 0; i < nbits; i++) {
+            m = (m << 1) | decode(&probs[m]);
+        }
+        return m - (1 << nbits);
+    }
+};
+
+int logz_decompress(const uint8_t *in, int packed, uint8_t *out, int raw) {
+    if (packed & LOGZ_STORED) {
+        if ((packed & ~LOGZ_STORED) != raw) return -1;
+        memcpy(out, in, raw);
+        return raw;
+    }
+    LogzModel model;
+    model.reset();
+    LogzDecoder rc(in, packed);
+    int o = 0;
+    while (o < raw) {
+        int slot = rc.tree(model.slot, 4);
+        if (slot == LOGZ_TEMPLATES) {
+            LogzTemplate *t = model.insert();
+            t->length = rc.tree(model.length, 6) + 1;
+            for (int i = 0; i < t->length; i++) {
+                t->text[i] = rc.tree(model.literal, 8);
+                if (t->text[i] == NUMBER_MARK) t->fields++;
+            }
+            if (t->fields > LOGZ_FIELDS) return -1;
+        } else if (slot < model.template_count) {
+            model.promote(slot);
+        } else {
+            return -1;
+        }
+        LogzTemplate *t = &model.templates[0];
+        int f = 0;
+        for (int i = 0; i < t->length; i++) {
+            if (t->text[i] != NUMBER_MARK) {
+                if (o == raw) return -1;
+                out[o++] = t->text[i];
+                continue;
+            }
+            int nbits = rc.tree(model.bits[f], 6);
+            if (nbits > 32) return -1;
+            uint32_t z = nbits == 0 ? 0 :
+                ((uint32_t) 1 << (nbits - 1)) | rc.direct(nbits - 1);
+            uint32_t v = unzigzag(z, t->last[f]);
+            t->last[f] = v;
+            f++;
+            char digits[10];
+            int nd = 0;
+            do {
+                digits[nd++] = '0' + v % 10;
+                v /= 10;
+            } while (v > 0 && nd < 10);
+            if (o + nd > raw) return -1;
+            while (nd > 0) out[o++] = digits[--nd];
+        }
+        if (rc.overrun()) return -1;
+    }
+    return o;
+}
@@ -0,0 +1,89 @@
+#ifndef LOGZ_H
+#define LOGZ_H
+
+#include <stdint.h>
+
+// Block compressor for Logger text, kept free of mbed so the host tools
+// decode with the same code.
+//
+// Every line is split into a template, the text with its numbers taken
+// out, and the numbers. Templates are kept in a short move-to-front list,
+// so a repeated one costs about a bit; a number is coded as the
+// difference to the same field of the last line with that template, its
+// bit length through an adaptive model per field. Everything goes through
+// a binary range coder whose models restart with every block, so blocks
+// decode independently and a torn file loses at most its last block.
+//
+// File:  LogzHeader, then blocks
+// Block: u16 raw length, u16 packed length (LOGZ_STORED set when the
+//        payload is the raw text), payload
+
+#define LOGZ_MAGIC 0x315A474C
+#define LOGZ_VERSION 1
+// Raw bytes per block; a block only holds whole lines
+#define LOGZ_BLOCK 2048
+#define LOGZ_BLOCK_HEADER 4
+#define LOGZ_STORED 0x8000
+
+#define LOGZ_TEMPLATES 8
+#define LOGZ_TEMPLATE_MAX 64
+#define LOGZ_FIELDS 8
+
+struct LogzHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t block_size;
+};
+
+struct LogzTemplate {
+    uint8_t text[LOGZ_TEMPLATE_MAX];
+    uint8_t length;
+    uint8_t fields;
+    uint32_t last[LOGZ_FIELDS];
+};
+
+// Adaptive state shared by the encoder and decoder
+struct LogzModel {
+    uint16_t slot[16];
+    uint16_t length[64];
+    uint16_t literal[256];
+    uint16_t bits[LOGZ_FIELDS][64];
+    LogzTemplate templates[LOGZ_TEMPLATES];
+    int template_count;
+
+    void reset();
+    // Move template i to the front
+    void promote(int i);
+    // Insert at the front, dropping the least recently used one
+    LogzTemplate *insert();
+};
+
+class LogzEncoder {
+    public:
+    // Packs n raw bytes, n <= LOGZ_BLOCK, into out as one block including
+    // its header. out must hold LOGZ_BLOCK + LOGZ_BLOCK_HEADER bytes; a
+    // block that does not shrink is stored. Returns the block length.
+    int compress(const uint8_t *in, int n, uint8_t *out);
+
+    private:
+    LogzModel model;
+    uint8_t *out;
+    int out_pos;
+    int out_limit;
+    uint64_t low;
+    uint32_t range;
+    uint8_t cache;
+    int cache_size;
+
+    void encode(uint16_t *p, int bit);
+    void direct(uint32_t value, int nbits);
+    void tree(uint16_t *probs, int nbits, int value);
+    void shift_low();
+    void flush();
+};
+
+// Decodes the payload of one block. Returns the raw length, or -1 when
+// the block is corrupt.
+int logz_decompress(const uint8_t *in, int packed, uint8_t *out, int raw);
+
+#endif
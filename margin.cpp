@@ -0,0 +1,96 @@
+#include "margin.h"
+#include <string.h>
+
+Margins::Margins() {
+    reset();
+}
+
+void Margins::reset() {
+    count = 0;
+    mode = 0;
+    test = 0;
+    step = 0;
+}
+
+void Margins::begin(int _mode) {
+    mode = _mode;
+    test = 0;
+    step = 0;
+}
+
+void Margins::next_case() {
+    test++;
+    step = 0;
+}
+
+MarginStats *Margins::add(int signal, int32_t window_us, int observed,
+        int32_t observed_us) {
+    MarginStats *s = NULL;
+    for (int i = 0; i < count && s == NULL; i++) {
+        if (stats[i].mode == mode && stats[i].test == test &&
+                stats[i].step == step) {
+            s = &stats[i];
+        }
+    }
+    if (s == NULL) {
+        if (count == MARGIN_ASSERTS) {
+            step++;
+            return NULL;
+        }
+        s = &stats[count++];
+        memset(s, 0, sizeof(*s));
+        s->mode = mode;
+        s->test = test;
+        s->step = step;
+        s->signal = signal;
+        s->min_us = 0x7FFFFFFF;
+        s->max_us = MARGIN_NONE;
+    }
+    step++;
+    
+    int32_t margin = MARGIN_NONE;
+    if (window_us > 0) {
+        if (signal != 0 && observed == signal) {
+            margin = window_us - observed_us;
+        } else if (signal != 0 && observed == 0) {
+            margin = window_us - observed_us;
+            if (margin > 0) margin = 0;
+        } else if (signal == 0 && observed != 0) {
+            margin = observed_us - window_us;
+            if (margin >= 0) margin = -1;
+        }
+    }
+    s->runs++;
+    if (observed != signal) s->failures++;
+    s->passed = observed == signal;
+    s->window_us = window_us;
+    s->observed_us = observed != 0 ? observed_us : -1;
+    s->last_us = margin;
+    if (margin != MARGIN_NONE) {
+        s->measured++;
+        s->sum_us += margin;
+        if (margin < s->min_us) s->min_us = margin;
+        if (margin > s->max_us) s->max_us = margin;
+        int bin = margin < 0 ? 0 : margin / MARGIN_BIN_US;
+        if (bin >= MARGIN_BINS) bin = MARGIN_BINS - 1;
+        if (s->bins[bin] < 0xFFFF) s->bins[bin]++;
+    }
+    return s;
+}
+
+bool Margins::in_case(const MarginStats *s) const {
+    return s->mode == mode && s->test == test;
+}
+
+int32_t Margins::percentile(const MarginStats *s, int q) {
+    if (s->measured == 0) return MARGIN_NONE;
+    // Counted from the small end: the margin q percent stayed above
+    uint32_t below = 0;
+    for (int i = 0; i < MARGIN_BINS; i++) {
+        below += s->bins[i];
+        if ((uint64_t) below * 100 > (uint64_t) s->measured * (100 - q)) {
+            return i == 0 ? s->min_us : i * MARGIN_BIN_US;
+        }
+    }
+    return s->max_us;
+}
@@ -0,0 +1,81 @@
+#ifndef MARGIN_H
+#define MARGIN_H
+
+#include <stdint.h>
+
+// Timing margins of the heart's conformance test assertions, kept per
+// assertion across runs. An assertion is named by the heart mode, the
+// test case within the run and its place within the case, so the same
+// line of a test lands in the same slot every run.
+//
+// The margin is how far the observed event was from failing it:
+//   event expected within the window, came at t    window - t
+//   event expected, none came                      window - elapsed, <= 0
+//   quiet expected, an event came at t             t - window, < 0
+// A quiet window that held, a wrong event, or an event expected with no
+// window has no margin; only its verdict counts.
+
+#define MARGIN_ASSERTS 32
+#define MARGIN_BINS 32
+#define MARGIN_BIN_US 1000
+// Passing assertions closer than this to failing are reported
+#define MARGIN_WARN_US 3000
+// Stands for no margin
+#define MARGIN_NONE (-0x7FFFFFFF - 1)
+
+struct MarginStats {
+    uint8_t mode;
+    uint8_t test;
+    uint8_t step;
+    // Signal (signals.h) expected, 0 for a quiet window
+    uint8_t signal;
+    uint32_t runs;
+    uint32_t failures;
+    // Runs with a margin, and their distribution; margins below 0 go in
+    // the first bin and beyond the last in the last
+    uint32_t measured;
+    int32_t min_us;
+    int32_t max_us;
+    int64_t sum_us;
+    uint16_t bins[MARGIN_BINS];
+    // The latest run
+    bool passed;
+    int32_t window_us;
+    int32_t observed_us;
+    int32_t last_us;
+};
+
+class Margins {
+    public:
+    MarginStats stats[MARGIN_ASSERTS];
+    int count;
+    
+    Margins();
+    
+    void reset();
+    
+    // Start of a test run in mode
+    void begin(int mode);
+    
+    // Start of the next test case within the run
+    void next_case();
+    
+    // One assertion: signal expected (0 for none) within window_us, 0 for
+    // no limit, and the signal that came after observed_us (0 for none).
+    // Returns its slot, NULL when all are taken.
+    MarginStats *add(int signal, int32_t window_us, int observed, int32_t observed_us);
+    
+    // Whether s is an assertion of the current test case
+    bool in_case(const MarginStats *s) const;
+    
+    // Margin that q percent of the measured runs kept at least, at bin
+    // resolution
+    static int32_t percentile(const MarginStats *s, int q);
+    
+    private:
+    uint8_t mode;
+    uint8_t test;
+    uint8_t step;
+};
+
+#endif
@@ -0,0 +1,76 @@
+#include "mbed.h"
+
+// NO_HEAP build: every allocator entry point stops with error(), naming
+// the entry point and the address it was called from. This is a run-time
+// trap only. newlib allocates behind stdio (fopen takes its FILE from the
+// heap once the standard streams hold the static ones), so a link-time
+// trap would fail every image that opens a file, used or not. Look the
+// address up in the map to find the caller.
+// Build with -DNO_HEAP.
+#ifdef NO_HEAP
+
+#define HEAP_TRAP(name) \
+    error("Heap disabled: " name " from %p\n", __builtin_return_address(0))
+
+extern "C" void *malloc(size_t) {
+    HEAP_TRAP("malloc");
+    return NULL;
+}
+
+extern "C" void *calloc(size_t, size_t) {
+    HEAP_TRAP("calloc");
+    return NULL;
+}
+
+extern "C" void *realloc(void *, size_t) {
+    HEAP_TRAP("realloc");
+    return NULL;
+}
+
+extern "C" void free(void *p) {
+    // free(NULL) is a no-op that library code makes freely
+    if (p != NULL) HEAP_TRAP("free");
+}
+
+// newlib's reentrant entry points, used by stdio and the float
+// conversions of printf
+extern "C" void *_malloc_r(struct _reent *, size_t) {
+    HEAP_TRAP("_malloc_r");
+    return NULL;
+}
+
+extern "C" void *_calloc_r(struct _reent *, size_t, size_t) {
+    HEAP_TRAP("_calloc_r");
+    return NULL;
+}
+
+extern "C" void *_realloc_r(struct _reent *, void *, size_t) {
+    HEAP_TRAP("_realloc_r");
+    return NULL;
+}
+
+extern "C" void _free_r(struct _reent *, void *p) {
+    if (p != NULL) HEAP_TRAP("_free_r");
+}
+
+// Thread's constructor references new[] for a dynamic stack even when it
+// is given a static one; only a call reaches the trap.
+void *operator new(size_t) {
+    HEAP_TRAP("new");
+    return NULL;
+}
+
+void *operator new[](size_t) {
+    HEAP_TRAP("new[]");
+    return NULL;
+}
+
+void operator delete(void *p) {
+    if (p != NULL) HEAP_TRAP("delete");
+}
+
+void operator delete[](void *p) {
+    if (p != NULL) HEAP_TRAP("delete[]");
+}
+
+#endif
@@ -1,143 +1,448 @@
 #include "mbed.h"
 #include "TextLCD.h"
 #include "rtos.h"
-#include "keyboard.h"
+#include "signals.h"
+#include "leds.h"
+#include "display.h"
+#include "console.h"
+#include "stacks.h"
+#include "jitter.h"
+#include "history.h"
+#include "pulse.h"
+#include "recorder.h"
+#include "pacing.h"
+#include "params.h"
+#include "localfs.h"
+#include "profile.h"
 #include <stdlib.h>
 #include <algorithm>
+#include <string.h>
 
-#define AP			0x01
-#define AS			0x02
-#define VP			0x04
-#define VS			0x08
 #define TO_NORMAL	0x0010
 #define TO_EXERCISE	0x0020
 #define TO_SLEEP	0x0040
 #define TO_MANUAL	0x0080
 #define MANUAL_AP	0x0100
-#define MANUAL_VP	0x0200
-#define INTERVAL_CHANGE	0x0400
-#define TO_DYNAMIC	0x0800
-
-#define AVI_max 100
-#define AVI_min 30
-#define PVARP 500
-#define VRP 500 
-#define PVARP_EXTEND 50
-
-// Values taken from
-// https://www.bostonscientific.com/content/dam/bostonscientific/quality/education-resources/english/ACL_AVSH_20091130.pdf
-#define AV_INCREASE 1.3
-#define DYNAMIC_AV_MIN 80
-#define DYNAMIC_AV_MAX 150
+#define MANUAL_VP	0x0800
+#define MODE_INPUT	0x1000
 
 #define AP_PIN p5
 #define AS_PIN p6
 #define VP_PIN p7
 #define VS_PIN p8
 
+// Scheduling policy: pacing preempts everything, the alarm check comes
+// next, display, LEDs and the console only run when both are waiting.
+#define PACE_PRIORITY osPriorityRealtime
+#define ALARM_PRIORITY osPriorityAboveNormal
+#define DISPLAY_PRIORITY osPriorityBelowNormal
+#define LED_PRIORITY osPriorityBelowNormal
+#define CONSOLE_PRIORITY osPriorityLow
+#define TRACE_PRIORITY osPriorityLow
+
+// Thread stacks in bytes, trimmed from the 'w' watermark report
+#define LED_STACK 512
+#define DISPLAY_STACK 1024
+#define ALARM_STACK 1024
+#define INPUT_STACK 1024
+#define MODE_SWITCH_STACK 512
+#define PACE_STACK 1024
+#define TRACE_STACK 1024
+
 // Define the LCD output for this code
 TextLCD lcd(p15, p16, p17, p18, p19, p20, TextLCD::LCD16x2);
 // Keyboard Input
 Serial pc(USBTX, USBRX);
-DigitalOut ap_led(LED1);
-DigitalOut as_led(LED2);
-DigitalOut vp_led(LED3);
-DigitalOut vs_led(LED4);
+Keyboard console_keyboard(&pc);
 // Communication
 InterruptIn as_interrupt(AS_PIN);
 InterruptIn vs_interrupt(VS_PIN);
-DigitalOut ap_out(AP_PIN);
-DigitalOut vp_out(VP_PIN);
+Pulse ap_out(AP_PIN);
+Pulse vp_out(VP_PIN);
 
-enum Pacemode { NORMAL, SLEEP, EXERCISE, MANUAL };
-Pacemode pace_mode = NORMAL;
+Pacing pacing;
+// Timing parameters, persisted to /local (localfs.h)
+ParamBlock params;
+Mutex params_mutex;
 
 bool mode_switch_input = false;
 bool manual_signal_input = false;
 char user_input = '~';
 char last_keyboard = ' ';
 
-int LRI[] = {2000, 1500, 600, 2000};
-int URI[] = {1000, 600, 343, 343};
-
-Keyboard * keyboard;
-
 Timer cA;
 Timer cV;
-Thread * led_addr;
-Thread * display_addr;
 Thread * alarm_addr;
 Thread * pace_addr;
+Thread * mode_switch_addr;
+
+// Pace emission time against the deadline pace_thread waited for
+Jitter ap_jitter;
+Jitter vp_jitter;
+
+// Rate, pacing and alarm history by seconds of uptime. pace_thread never
+// takes history_mutex: it queues its events, and the lower priority
+// threads that use the history fold them in under the mutex first.
+History history;
+Mutex history_mutex;
+Ticker uptime_ticker;
+volatile uint32_t uptime = 0;
+
+// Single producer (pace_thread), consumers serialized by history_mutex.
+// Sized for the 5 s alarm_thread spends on its message at the fastest
+// rates; a full queue drops the event.
+#define HISTORY_QUEUE 64
+struct HistoryEvent {
+    uint32_t now;
+    bool ventricular;
+    bool paced;
+    int interval;
+    int avi;
+};
+HistoryEvent history_queue[HISTORY_QUEUE];
+volatile int history_head = 0;
+volatile int history_tail = 0;
+volatile uint32_t history_dropped = 0;
 
-int observation_interval = 10000;
+THREAD_STACK(led_stack, LED_STACK);
+THREAD_STACK(display_stack, DISPLAY_STACK);
+THREAD_STACK(alarm_stack, ALARM_STACK);
+THREAD_STACK(input_stack, INPUT_STACK);
+THREAD_STACK(mode_switch_stack, MODE_SWITCH_STACK);
+THREAD_STACK(pace_stack, PACE_STACK);
+THREAD_STACK(trace_stack, TRACE_STACK);
 
-// PVARP extension
-bool extend_PVARP = false;
-bool extend_last = false;
+// Sense edges through the interrupt and signal path, listed with 'c'.
+// Signals raised again before pace_thread wakes merge into one, so
+// signalled - woken is the count coalesced; a wake that also carries a
+// mode change or the other sense only handles one of them, the rest are
+// dropped.
+struct SenseCount {
+    volatile uint32_t irq;
+    volatile uint32_t signalled;
+    uint32_t woken;
+    uint32_t dropped;
+    uint32_t accepted;
+};
 
-// Dynamic AVI
-bool use_dynamic_AVI = false;
-int dynamic_AVI = AVI_max;
+SenseCount a_count;
+SenseCount v_count;
 
 void a_sense() {
+    PROFILE_SCOPE("a_sense");
+    Recorder::record(TRACE_AS, 1);
+    console_event(AS);
+    a_count.irq++;
     led_addr->signal_set(AS);
-    if (pace_mode != MANUAL) pace_addr->signal_set(AS);
+    if (pacing.mode != MANUAL) {
+        a_count.signalled++;
+        pace_addr->signal_set(AS);
+    }
 }
 
 void v_sense() {
+    PROFILE_SCOPE("v_sense");
+    Recorder::record(TRACE_VS, 1);
+    console_event(VS);
+    v_count.irq++;
     led_addr->signal_set(VS);
     display_addr->signal_set(VS);
     alarm_addr->signal_set(VS);
-    if (pace_mode != MANUAL) pace_addr->signal_set(VS);
+    if (pacing.mode != MANUAL) {
+        v_count.signalled++;
+        pace_addr->signal_set(VS);
+    }
+}
+
+void a_sense_end() {
+    Recorder::record(TRACE_AS, 0);
+}
+
+void v_sense_end() {
+    Recorder::record(TRACE_VS, 0);
+}
+
+void a_pace_end() {
+    Recorder::record(TRACE_AP, 0);
+}
+
+void v_pace_end() {
+    Recorder::record(TRACE_VP, 0);
+}
+
+// Called by pace_thread once per wake with the sense it acted on
+void count_wake(int signum, int handled) {
+    if (signum & AS) {
+        a_count.woken++;
+        if (!(handled & AS)) a_count.dropped++;
+    }
+    if (signum & VS) {
+        v_count.woken++;
+        if (!(handled & VS)) v_count.dropped++;
+    }
+}
+int set_param(const char *name, int value) {
+    params_mutex.lock();
+    PaceParams p;
+    params.read(&p);
+    int result = params_set(&p, name, value);
+    if (result == 0) {
+        params.write(p);
+    }
+    params_mutex.unlock();
+    return result;
+}
+
+void toggle_param(int PaceParams::*field) {
+    params_mutex.lock();
+    PaceParams p;
+    params.read(&p);
+    p.*field = !(p.*field);
+    params.write(p);
+    params_mutex.unlock();
+}
+
+void list_params() {
+    PaceParams p;
+    int version = params.read(&p);
+    console_print(FormatLine() << "\n\rParameters v" << version);
+    for (int i = 0; i < params_count(); i++) {
+        console_print(FormatLine() << "\n\r" << params_name(i) << '=' << params_get(&p, i));
+    }
 }
-void set_observation_interval() {
+
+// p lists, p<name>=<value> sets, psave and pload persist
+void param_command() {
+    char name[20];
     int i = 1;
-    observation_interval = 0;
-    while (keyboard->command[i] != '~') {
-        observation_interval = observation_interval * 10 + (keyboard->command[i] - '0');
-        i ++;
+    int n = 0;
+    while (i < 20 && keyboard->command[i] != '~' && keyboard->command[i] != '=') {
+        name[n++] = keyboard->command[i++];
+    }
+    name[n] = '\0';
+    if (n == 0) {
+        list_params();
+    } else if (i < 20 && keyboard->command[i] == '=') {
+        int value = keyboard->read_number(i + 1);
+        int result = set_param(name, value);
+        if (result == -1) {
+            console_print(FormatLine() << "\n\rUnknown parameter: " << name);
+        } else if (result == -2) {
+            console_print(FormatLine() << "\n\rRejected: " << name << '=' << value);
+        } else {
+            console_print(FormatLine() << "\n\r" << name << " set to: " << value);
+        }
+    } else if (strcmp(name, "save") == 0) {
+        PaceParams p;
+        params.read(&p);
+        console_print(params_save(&p, PARAMS_FILE) ?
+            "\n\rParameters saved" : "\n\rSave failed");
+    } else if (strcmp(name, "load") == 0) {
+        params_mutex.lock();
+        PaceParams p;
+        params.read(&p);
+        int applied = params_load(&p, PARAMS_FILE);
+        if (applied > 0) {
+            params.write(p);
+        }
+        params_mutex.unlock();
+        console_print(FormatLine() << "\n\rLoaded " << max(applied, 0) << " parameters");
+    } else {
+        console_print(FormatLine() << "\n\rUnknown parameter command: " << name);
+    }
+}
+
+void list_stacks() {
+    console_print("\n\rStack peak/size");
+    for (int i = 0; i < stack_count(); i++) {
+        console_print(FormatLine() << "\n\r" << stack_name(i) << ' ' << stack_peak(i) << '/' << stack_size(i));
+    }
+}
+
+void list_jitter(const char *name, Jitter *j) {
+    console_print(FormatLine() << "\n\r" << name << ": " << j->count
+        << " paces, p99 " << j->percentile(99) << "us, max " << j->max_us
+        << "us, " << j->misses << " missed, " << j->early << " early");
+    FormatLine bins;
+    bins << "\n\r ";
+    for (int i = 0; i < JITTER_BINS; i++) {
+        bins << ' ' << j->bins[i];
+    }
+    console_print(bins);
+}
+
+void list_sense(const char *name, SenseCount *c) {
+    console_print(FormatLine() << "\n\r" << name << ' ' << pad(c->irq, 9)
+        << ' ' << pad(c->woken, 9) << ' ' << pad(c->signalled - c->woken, 9)
+        << ' ' << pad(c->dropped, 7) << ' ' << pad(c->accepted, 8));
+}
+
+// c lists the sense counters, cr clears them
+void sense_command() {
+    if (keyboard->command[1] == 'r') {
+        memset(&a_count, 0, sizeof(a_count));
+        memset(&v_count, 0, sizeof(v_count));
+        console_print("\n\rSense counters cleared");
+        return;
+    }
+    console_print("\n\r         irq     woken coalesced dropped accepted");
+    list_sense("AS", &a_count);
+    list_sense("VS", &v_count);
+}
+
+void tick_uptime() {
+    uptime++;
+}
+
+void history_queue_event(bool ventricular, bool paced, int interval, int avi) {
+    int next = (history_head + 1) % HISTORY_QUEUE;
+    if (next == history_tail) {
+        history_dropped++;
+        return;
+    }
+    HistoryEvent *e = &history_queue[history_head];
+    e->now = uptime;
+    e->ventricular = ventricular;
+    e->paced = paced;
+    e->interval = interval;
+    e->avi = avi;
+    // The slot is complete before the consumer can see it
+    __DMB();
+    history_head = next;
+}
+
+void history_atrial(bool paced) {
+    history_queue_event(false, paced, -1, -1);
+}
+
+void history_ventricular(bool paced, int interval, int avi) {
+    history_queue_event(true, paced, interval, avi);
+}
+
+// Moves queued events into the history; history_mutex held
+void history_fold() {
+    int end = history_head;
+    __DMB();
+    while (history_tail != end) {
+        const HistoryEvent &e = history_queue[history_tail];
+        if (e.ventricular) {
+            history.ventricular(e.now, e.paced, e.interval, e.avi);
+        } else {
+            history.atrial(e.now, e.paced);
+        }
+        history_tail = (history_tail + 1) % HISTORY_QUEUE;
+    }
+}
+
+void history_alarm(bool fast) {
+    history_mutex.lock();
+    history_fold();
+    history.alarm(uptime, fast);
+    history_mutex.unlock();
+}
+
+// First bucket of a level starting at or after start, closed or open
+bool history_find(int level, uint32_t start, HistoryBucket *out) {
+    bool found = false;
+    history_mutex.lock();
+    history_fold();
+    history.advance(uptime);
+    for (int i = 0; i < history.count(level) && !found; i++) {
+        if (history.get(level, i).start >= start) {
+            *out = history.get(level, i);
+            found = true;
+        }
+    }
+    if (!found && history.current(level).start >= start) {
+        *out = history.current(level);
+        found = true;
+    }
+    history_mutex.unlock();
+    return found;
+}
+
+// y<s|m|h>[from[-to]] lists the buckets of one resolution that start in
+// [from, to) seconds of uptime. The lock is only held to copy one bucket.
+void history_command() {
+    char c = keyboard->command[1];
+    int level = (c == 's') ? 0 : (c == 'm') ? 1 : (c == 'h') ? 2 : -1;
+    if (level < 0) {
+        console_print(FormatLine() << "\n\rys, ym or yh [from[-to]], uptime " << uptime
+            << "s, " << history_dropped << " events dropped");
+        return;
+    }
+    uint32_t from = keyboard->read_number(2);
+    uint32_t to = 0xFFFFFFFF;
+    for (int i = 2; i < 19; i++) {
+        if (keyboard->command[i] == '-') {
+            to = keyboard->read_number(i + 1);
+            break;
+        }
+    }
+    console_print("\n\r  start rate min/avg/max       AP/AS       VP/VS AVI min/avg/max fast/slow");
+    HistoryBucket b;
+    uint32_t next = from;
+    while (next < to && history_find(level, next, &b) && b.start < to) {
+        console_print(FormatLine() << "\n\r" << pad(b.start, 7) << ' '
+            << pad(b.rate_min, 8) << '/'
+            << pad(b.rate_count ? (int) (b.rate_sum / b.rate_count) : 0, 3)
+            << '/' << pad(b.rate_max, 3) << ' '
+            << pad(b.paced_a, 5) << '/' << pad(b.sensed_a, 5) << ' '
+            << pad(b.paced_v, 5) << '/' << pad(b.sensed_v, 5) << ' '
+            << pad(b.avi_min, 7) << '/'
+            << pad(b.avi_count ? (int) (b.avi_sum / b.avi_count) : 0, 3)
+            << '/' << pad(b.avi_max, 3) << ' '
+            << pad(b.alarms_fast, 4) << '/' << b.alarms_slow);
+        next = b.start + History::period(level);
+    }
+}
+
+// f lists the profile, ff writes it as folded stacks, fr clears it
+void profile_command() {
+    char c = keyboard->command[1];
+    if (c == 'r') {
+        profile_reset();
+        console_print("\n\rProfile cleared");
+    } else {
+        profile_dump(console_output, c == 'f');
     }
-	display_addr->signal_set(INTERVAL_CHANGE);
 }
 
 void interpret_command() {
     if(keyboard->command[0] == 'o') {
-        set_observation_interval();
-        pc.printf("\n\rObservation interval set to: %d", observation_interval);
+        set_observation_interval(keyboard->read_number(1));
+        console_print(FormatLine() << "\n\rObservation interval set to: " << observation_interval);
+    } else if(keyboard->command[0] == 'p') {
+        param_command();
+    } else if(keyboard->command[0] == 'w') {
+        list_stacks();
+    } else if(keyboard->command[0] == 'j') {
+        console_print(FormatLine() << "\n\rPace lateness, " << JITTER_BIN_US << "us bins");
+        list_jitter("AP", &ap_jitter);
+        list_jitter("VP", &vp_jitter);
+    } else if(keyboard->command[0] == 'y') {
+        history_command();
+    } else if(keyboard->command[0] == 'f') {
+        profile_command();
+    } else if(keyboard->command[0] == 'c') {
+        sense_command();
     } else if (Keyboard::my_strequal(keyboard->command,"help",4)) {
-        pc.printf("THIS IS HELP");
+        console_print("THIS IS HELP");
     } else {
         user_input = keyboard->command[0];
         mode_switch_input = true;
-        if (pace_mode == MANUAL && user_input == 'v') {
+        mode_switch_addr->signal_set(MODE_INPUT);
+        if (pacing.mode == MANUAL && user_input == 'v') {
             pace_addr->signal_set(MANUAL_VP);
-        } else if (pace_mode == MANUAL && user_input == 'a') {
+        } else if (pacing.mode == MANUAL && user_input == 'a') {
             pace_addr->signal_set(MANUAL_AP);
         }
     }
 }
 
-void input_thread(void const * args) {
-    keyboard->prompt();
-    keyboard->reset_command();
-    while(1) {
-        keyboard->last_keyboard = pc.getc();
-        keyboard->read_char(keyboard->last_keyboard);
-        
-        if (keyboard->last_keyboard != '\r') {
-            pc.putc(keyboard->last_keyboard);
-        }
-        
-        if (keyboard->last_keyboard == '\r' || keyboard->command_complete()) {
-            interpret_command();
-            keyboard->reset_command();
-            keyboard->prompt();
-        }
-    }
-}
-
 void mode_switch_thread(void const * args) {
     while(1) {
+        Thread::signal_wait(MODE_INPUT);
         if (mode_switch_input) {
             if (user_input == 'n' || user_input == 'N') {
                 pace_addr->signal_set(TO_NORMAL);
@@ -147,10 +452,12 @@ void mode_switch_thread(void const * args) {
                 pace_addr->signal_set(TO_SLEEP);
             } else if (user_input == 'm' || user_input == 'M') {
                 pace_addr->signal_set(TO_MANUAL);
+            } else if (user_input == 'q' || user_input == 'Q') {
+                Recorder::close_trace_file();
             } else if (user_input == 'x' || user_input == 'X') {
-				extend_PVARP = !extend_PVARP;
+				toggle_param(&PaceParams::extend_pvarp);
 			} else if (user_input == 'd' || user_input == 'D') {
-				pace_addr->signal_set(TO_DYNAMIC);
+				toggle_param(&PaceParams::dynamic_avi);
 			}
             mode_switch_input = false;
         }    
@@ -158,158 +465,109 @@ void mode_switch_thread(void const * args) {
 }
 
 void send_AP() {
-	ap_out = 1;
-	Thread::wait(5);
-	ap_out = 0;
+	Recorder::record(TRACE_AP, 1);
+	ap_out.fire();
+	console_event(AP);
 }
 
 void send_VP() {
-	vp_out = 1;
-	Thread::wait(5);
-	vp_out = 0;
+	Recorder::record(TRACE_VP, 1);
+	vp_out.fire();
+	console_event(VP);
+}
+
+// Edges are shared with the heart's own trace, which is how
+// host/trace_merge.cpp puts both on one clock. Stops once 'q' has
+// closed the trace file.
+void trace_thread(void const * args) {
+    while (Recorder::is_open()) {
+        Recorder::flush();
+        Thread::wait(50);
+    }
 }
 
 void pace_thread(void const * args) {
-    bool vnext = 0;
     while (true) {
-        if (pace_mode == MANUAL) {
+        if (pacing.mode == MANUAL) {
             osEvent sig = Thread::signal_wait(0x00);
             int signum = sig.value.signals;
             if (signum & TO_EXERCISE) {
-                pace_mode = EXERCISE;
+                pacing.mode = EXERCISE;
             } else if (signum & TO_SLEEP) {
-                pace_mode = SLEEP;
+                pacing.mode = SLEEP;
             } else if (signum & TO_NORMAL) {
-                pace_mode = NORMAL;
+                pacing.mode = NORMAL;
             } else if (signum & MANUAL_VP) {
                 led_addr->signal_set(VP);
                 display_addr->signal_set(VP);
                 alarm_addr->signal_set(VP);
+                history_ventricular(true, cV.read_ms(), -1);
                 cV.reset();
                 send_VP();
-                vnext = false;
+                pacing.manual_v();
             } else if (signum & MANUAL_AP) {
                 led_addr->signal_set(AP);
+                history_atrial(true);
                 cA.reset();
                 send_AP();
-                vnext = true;
+                pacing.manual_a();
             }
+            count_wake(signum, 0);
         } else {
-            int next;
-            if (vnext) {
-                next = std::min(LRI[pace_mode]-cV.read_ms(), 
-					use_dynamic_AVI ? 
-						dynamic_AVI-cA.read_ms() :
-						AVI_max-cA.read_ms());
-            } else {
-                next = LRI[pace_mode] - AVI_min - cV.read_ms();
-            }
-            next = max(next, 1);
+            // One consistent parameter snapshot per decision
+            PaceParams p;
+            params.read(&p);
+            int next = pacing.next(p, cA.read_ms(), cV.read_ms());
+            uint32_t deadline = us_ticker_read() + next * 1000;
             osEvent sig = Thread::signal_wait(0x00, next);
+            PROFILE_SCOPE("pace_decision");
             int signum = sig.value.signals;
+            int handled = 0;
             if (signum & TO_MANUAL) {
-                pace_mode = MANUAL;
+                pacing.mode = MANUAL;
             } else if (signum & TO_EXERCISE) {
-                pace_mode = EXERCISE;
+                pacing.mode = EXERCISE;
             } else if (signum & TO_SLEEP) {
-                pace_mode = SLEEP;
+                pacing.mode = SLEEP;
             } else if (signum & TO_NORMAL) {
-                pace_mode = NORMAL;
-			} else if (signum & TO_DYNAMIC) {
-				use_dynamic_AVI = !use_dynamic_AVI;
+                pacing.mode = NORMAL;
             } else if (signum & AS) {
-				// Modified for PVARP extension
-                if (!vnext &&
-					((!extend_last || !extend_PVARP) && cV.read_ms() >= PVARP) ||
-					(extend_last && extend_PVARP && cV.read_ms() >= PVARP + PVARP_EXTEND)) {
-					extend_last = false;
+                handled = AS;
+                if (pacing.sense_a(p, cA.read_ms(), cV.read_ms())) {
+                    a_count.accepted++;
                     cA.reset();
-                    vnext = true;
+                    history_atrial(false);
                 }
             } else if (signum & VS) {
-				// Modified for PVARP extension
-                if ((vnext || (!vnext && extend_PVARP && !extend_last))
-					&& (cV.read_ms() >= URI[pace_mode]) &&
-                    (cV.read_ms() >= VRP) && (cA.read_ms() >= AVI_min)) {
-					if (!vnext) {
-						extend_last = true;
-					} else {
-						// Update dynamic AVI
-						dynamic_AVI = max(DYNAMIC_AV_MIN,
-							min(DYNAMIC_AV_MAX, (int) (AV_INCREASE * cA.read_ms())));
-					}
+                handled = VS;
+                int ca = cA.read_ms();
+                int cv = cV.read_ms();
+                bool after_a = pacing.vnext;
+                if (pacing.sense_v(p, ca, cv)) {
+                    v_count.accepted++;
                     cV.reset();
-                    vnext = false;
+                    history_ventricular(false, cv, after_a ? ca : -1);
                 }
             } else {
-                if (vnext) {
-					// Update dynamic AVI
-					dynamic_AVI = max(DYNAMIC_AV_MIN,
-						min(DYNAMIC_AV_MAX, (int) (AV_INCREASE * cA.read_ms())));
+                int ca = cA.read_ms();
+                int cv = cV.read_ms();
+                if (pacing.pace(p, ca, cv) == PACE_VP) {
                     cV.reset();
                     send_VP();
+                    vp_jitter.add((int) (us_ticker_read() - deadline));
                     led_addr->signal_set(VP);
                     display_addr->signal_set(VP);
                     alarm_addr->signal_set(VP);
-                    vnext = false;
+                    history_ventricular(true, cv, ca);
                 } else {
                     cA.reset();
                     send_AP();
+                    ap_jitter.add((int) (us_ticker_read() - deadline));
                     led_addr->signal_set(AP);
-					extend_last = false;
-                    vnext = true;
+                    history_atrial(true);
                 }
             }
-        }
-    }
-}
-
-void led_thread(void const * args) {
-    while (true) {
-        osEvent sig = Thread::signal_wait(0x00);
-        int signum = sig.value.signals;
-        if (signum & AP) {
-            ap_led = 1;
-            Thread::wait(100);
-            ap_led = 0;
-        } else if (signum & AS) {
-            as_led = 1;
-            Thread::wait(100);
-            as_led = 0;
-        } else if (signum & VP) {
-            vp_led = 1;
-            Thread::wait(100);
-            vp_led = 0;
-        } else if (signum & VS) {
-            vs_led = 1;
-            Thread::wait(100);
-            vs_led = 0;
-        }
-    }
-}
-
-void display_thread(void const * args) {
-    Timer t;
-    int count = 0;
-    lcd.printf("Initialized\n\n");
-    t.reset();
-    t.start();
-    while (true) {
-        osEvent sig = Thread::signal_wait(0x00, observation_interval - t.read_ms());
-        int signum = sig.value.signals;
-        if ((signum & VP) || (signum & VS)) {
-            count++;
-        } else if (signum & INTERVAL_CHANGE) {
-			t.reset();
-			count = 0;
-			lcd.locate(0,0);
-			lcd.printf("Initialized\n\n");
-		} else {
-            double bpm = (double) count * 60000.0 / (double) observation_interval;
-            lcd.locate(0,0);
-            lcd.printf("%f BPM", bpm);
-            count = 0;
-            t.reset();
+            count_wake(signum, handled);
         }
     }
 }
@@ -321,15 +579,21 @@ void alarm_thread(void const * args) {
     bool first = true;
 	int interval = 15;
     while (true) {
-        osEvent sig = Thread::signal_wait(0x00, LRI[pace_mode] - t.read_ms() + interval);
+        PaceParams p;
+        params.read(&p);
+        osEvent sig = Thread::signal_wait(0x00, p.lri[pacing.mode] - t.read_ms() + interval);
         int signum = sig.value.signals;
+        history_mutex.lock();
+        history_fold();
+        history_mutex.unlock();
         if ((signum & VP) || (signum & VS)) {
-            if (!first && t.read_ms() < URI[pace_mode]) {
+            if (!first && t.read_ms() < p.uri[pacing.mode]) {
+                history_alarm(true);
                 lcd.locate(0, 1);
-                lcd.printf("ERR_FAST");
+                lcd_print(&lcd, "ERR_FAST");
                 Thread::wait(5000);
                 lcd.locate(0, 1);
-                lcd.printf("        ");
+                lcd_print(&lcd, "        ");
                 t.reset();
                 first = true;
             } else {
@@ -337,11 +601,12 @@ void alarm_thread(void const * args) {
                 first = false;
             }
         } else {
+            history_alarm(false);
             lcd.locate(0, 1);
-            lcd.printf("ERR_SLOW");
+            lcd_print(&lcd, "ERR_SLOW");
             Thread::wait(5000);
             lcd.locate(0, 1);
-            lcd.printf("        ");
+            lcd_print(&lcd, "        ");
             t.reset();
             first = true;
         }
@@ -349,8 +614,17 @@ void alarm_thread(void const * args) {
 }
 
 int main() {
+    profile_init();
+    // Restore tuned parameters
+    PaceParams p;
+    params.read(&p);
+    if (params_load(&p, PARAMS_FILE) > 0) {
+        params.write(p);
+    }
+    Recorder::create_trace_file(TRACE_BOARD_PACE);
     // Initialize keyboard
-    keyboard = new Keyboard(&pc);
+    console_init(&pc, &console_keyboard, &interpret_command, false);
+    uptime_ticker.attach(&tick_uptime, 1.0);
     // Initialize the clocks to some reasonable time
     cA.reset();
     cA.start();
@@ -361,17 +635,33 @@ int main() {
     // Assign interrupts
     as_interrupt.rise(&a_sense);
     vs_interrupt.rise(&v_sense);
+    as_interrupt.fall(&a_sense_end);
+    vs_interrupt.fall(&v_sense_end);
+    ap_out.on_complete(&a_pace_end);
+    vp_out.on_complete(&v_pace_end);
     // Initialize the threads
-    Thread leds(led_thread);
+    Thread leds(led_thread, NULL, LED_PRIORITY, LED_STACK,
+        stack_paint("led", led_stack, LED_STACK));
     led_addr = &leds;
-    Thread display(display_thread);
+    Thread display(display_thread, &lcd, DISPLAY_PRIORITY, DISPLAY_STACK,
+        stack_paint("display", display_stack, DISPLAY_STACK));
     display_addr = &display;
-    Thread alarm(alarm_thread);
+    Thread alarm(alarm_thread, NULL, ALARM_PRIORITY, ALARM_STACK,
+        stack_paint("alarm", alarm_stack, ALARM_STACK));
     alarm_addr = &alarm;
-    Thread keyboard(input_thread);
-    Thread mode_switch(mode_switch_thread);
-    Thread pace(pace_thread);
+    Thread keyboard(input_thread, NULL, CONSOLE_PRIORITY, INPUT_STACK,
+        stack_paint("input", input_stack, INPUT_STACK));
+    keyboard_addr = &keyboard;
+    Thread mode_switch(mode_switch_thread, NULL, CONSOLE_PRIORITY, MODE_SWITCH_STACK,
+        stack_paint("mode_switch", mode_switch_stack, MODE_SWITCH_STACK));
+    mode_switch_addr = &mode_switch;
+    Thread trace(trace_thread, NULL, TRACE_PRIORITY, TRACE_STACK,
+        stack_paint("trace", trace_stack, TRACE_STACK));
+    Thread pace(pace_thread, NULL, PACE_PRIORITY, PACE_STACK,
+        stack_paint("pace", pace_stack, PACE_STACK));
     pace_addr = &pace;
     
-    while (true) { }
+    while (true) {
+        Thread::wait(osWaitForever);
+    }
 }
\ No newline at end of file
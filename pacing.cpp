@@ -0,0 +1,79 @@
+#include "pacing.h"
+#include "profile.h"
+#include <algorithm>
+
+Pacing::Pacing() {
+    mode = NORMAL;
+    vnext = false;
+    extend_last = false;
+    dynamic_AVI = AVI_max;
+}
+
+int Pacing::next(const PaceParams &p, int ca, int cv) {
+    PROFILE_SCOPE("next");
+    int next;
+    if (vnext) {
+        next = std::min(p.lri[mode] - cv,
+            p.dynamic_avi ?
+                dynamic_AVI - ca :
+                p.avi_max - ca);
+    } else {
+        next = p.lri[mode] - p.avi_min - cv;
+    }
+    return std::max(next, 1);
+}
+
+bool Pacing::sense_a(const PaceParams &p, int /*ca*/, int cv) {
+    PROFILE_SCOPE("sense_a");
+    // Modified for PVARP extension
+    if ((!vnext &&
+        (!extend_last || !p.extend_pvarp) && cv >= p.pvarp) ||
+        (extend_last && p.extend_pvarp && cv >= p.pvarp + p.pvarp_extend)) {
+        extend_last = false;
+        vnext = true;
+        return true;
+    }
+    return false;
+}
+
+bool Pacing::sense_v(const PaceParams &p, int ca, int cv) {
+    PROFILE_SCOPE("sense_v");
+    // Modified for PVARP extension
+    if ((vnext || (!vnext && p.extend_pvarp && !extend_last))
+        && (cv >= p.uri[mode]) &&
+        (cv >= p.vrp) && (ca >= p.avi_min)) {
+        if (!vnext) {
+            extend_last = true;
+        } else {
+            update_AVI(ca);
+        }
+        vnext = false;
+        return true;
+    }
+    return false;
+}
+
+int Pacing::pace(const PaceParams &/*p*/, int ca, int /*cv*/) {
+    PROFILE_SCOPE("pace");
+    if (vnext) {
+        update_AVI(ca);
+        vnext = false;
+        return PACE_VP;
+    }
+    extend_last = false;
+    vnext = true;
+    return PACE_AP;
+}
+
+void Pacing::manual_a() {
+    vnext = true;
+}
+
+void Pacing::manual_v() {
+    vnext = false;
+}
+
+void Pacing::update_AVI(int ca) {
+    dynamic_AVI = std::max(DYNAMIC_AV_MIN,
+        std::min(DYNAMIC_AV_MAX, ca * AV_INCREASE_X10 / 10));
+}
@@ -0,0 +1,56 @@
+#ifndef PACING_H
+#define PACING_H
+
+#include "params.h"
+
+// Pacing decisions for the pacemaker, kept free of mbed so the same code
+// runs on the board and in host simulations. Callers own the atrial and
+// ventricular clocks (cA, cV) and pass their current readings in ms,
+// together with the parameter snapshot for this decision.
+
+// Values taken from
+// https://www.bostonscientific.com/content/dam/bostonscientific/quality/education-resources/english/ACL_AVSH_20091130.pdf
+#define AV_INCREASE_X10 13 // 1.3, in tenths
+#define DYNAMIC_AV_MIN 80
+#define DYNAMIC_AV_MAX 150
+
+// Return values of Pacing::pace
+#define PACE_AP 0x01
+#define PACE_VP 0x04
+
+enum Pacemode { NORMAL, SLEEP, EXERCISE, MANUAL };
+
+class Pacing {
+    public:
+    Pacemode mode;
+    bool vnext;
+    
+    // PVARP extension
+    bool extend_last;
+    
+    // Dynamic AVI
+    int dynamic_AVI;
+    
+    Pacing();
+    
+    // Milliseconds until the next pace is due, at least 1
+    int next(const PaceParams &p, int ca, int cv);
+    
+    // Return true when the sense is accepted; the caller then resets the
+    // matching clock
+    bool sense_a(const PaceParams &p, int ca, int cv);
+    bool sense_v(const PaceParams &p, int ca, int cv);
+    
+    // The deadline from next() has passed. Returns PACE_AP or PACE_VP; the
+    // caller emits the pulse and resets the matching clock
+    int pace(const PaceParams &p, int ca, int cv);
+    
+    // Manual mode pulses
+    void manual_a();
+    void manual_v();
+    
+    private:
+    void update_AVI(int ca);
+};
+
+#endif
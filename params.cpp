@@ -0,0 +1,163 @@
+#include "params.h"
+#include "format.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct ParamInfo {
+    const char *name;
+    size_t offset;
+    int min;
+    int max;
+};
+
+static const ParamInfo param_info[] = {
+    { "lri0", offsetof(PaceParams, lri) + 0 * sizeof(int), 300, 3000 },
+    { "lri1", offsetof(PaceParams, lri) + 1 * sizeof(int), 300, 3000 },
+    { "lri2", offsetof(PaceParams, lri) + 2 * sizeof(int), 300, 3000 },
+    { "lri3", offsetof(PaceParams, lri) + 3 * sizeof(int), 300, 3000 },
+    { "uri0", offsetof(PaceParams, uri) + 0 * sizeof(int), 250, 2000 },
+    { "uri1", offsetof(PaceParams, uri) + 1 * sizeof(int), 250, 2000 },
+    { "uri2", offsetof(PaceParams, uri) + 2 * sizeof(int), 250, 2000 },
+    { "uri3", offsetof(PaceParams, uri) + 3 * sizeof(int), 250, 2000 },
+    { "avimin", offsetof(PaceParams, avi_min), 10, 200 },
+    { "avimax", offsetof(PaceParams, avi_max), 30, 300 },
+    { "pvarp", offsetof(PaceParams, pvarp), 100, 1000 },
+    { "vrp", offsetof(PaceParams, vrp), 100, 1000 },
+    { "pvext", offsetof(PaceParams, pvarp_extend), 0, 500 },
+    { "xpvarp", offsetof(PaceParams, extend_pvarp), 0, 1 },
+    { "dynavi", offsetof(PaceParams, dynamic_avi), 0, 1 },
+};
+
+#define PARAM_COUNT ((int) (sizeof(param_info) / sizeof(param_info[0])))
+
+#define PARAMS_BARRIER() __sync_synchronize()
+
+void params_defaults(PaceParams *p) {
+    static const int lri[] = {2000, 1500, 600, 2000};
+    static const int uri[] = {1000, 600, 343, 343};
+    memcpy(p->lri, lri, sizeof(lri));
+    memcpy(p->uri, uri, sizeof(uri));
+    p->avi_min = AVI_min;
+    p->avi_max = AVI_max;
+    p->pvarp = PVARP;
+    p->vrp = VRP;
+    p->pvarp_extend = PVARP_EXTEND;
+    p->extend_pvarp = 0;
+    p->dynamic_avi = 0;
+}
+
+static int *field(PaceParams *p, int i) {
+    return (int *) ((char *) p + param_info[i].offset);
+}
+
+static bool consistent(const PaceParams *p) {
+    for (int m = 0; m < 4; m++) {
+        if (p->uri[m] > p->lri[m]) return false;
+    }
+    return p->avi_min <= p->avi_max;
+}
+
+int params_set(PaceParams *p, const char *name, int value) {
+    for (int i = 0; i < PARAM_COUNT; i++) {
+        if (strcmp(name, param_info[i].name) != 0) {
+            continue;
+        }
+        if (value < param_info[i].min || value > param_info[i].max) {
+            return -2;
+        }
+        PaceParams next = *p;
+        *field(&next, i) = value;
+        if (!consistent(&next)) {
+            return -2;
+        }
+        *p = next;
+        return 0;
+    }
+    return -1;
+}
+
+int params_count() {
+    return PARAM_COUNT;
+}
+
+const char *params_name(int i) {
+    return param_info[i].name;
+}
+
+int params_get(const PaceParams *p, int i) {
+    return *field((PaceParams *) p, i);
+}
+
+bool params_save(const PaceParams *p, const char *path) {
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        return false;
+    }
+    FormatBuffer<32> line;
+    for (int i = 0; i < PARAM_COUNT; i++) {
+        line.clear();
+        line << param_info[i].name << '=' << params_get(p, i) << '\n';
+        fputs(line.c_str(), fp);
+    }
+    fclose(fp);
+    return true;
+}
+
+int params_load(PaceParams *p, const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+    char line[32];
+    int applied = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char *eq = strchr(line, '=');
+        if (eq == NULL) {
+            continue;
+        }
+        *eq = '\0';
+        if (params_set(p, line, atoi(eq + 1)) == 0) {
+            applied++;
+        }
+    }
+    fclose(fp);
+    return applied;
+}
+
+ParamBlock::ParamBlock() {
+    params_defaults(&slot[0]);
+    slot[1] = slot[0];
+    slot_version[0] = 0;
+    slot_version[1] = 0;
+    current = 0;
+}
+
+uint32_t ParamBlock::read(PaceParams *out) const {
+    while (true) {
+        uint32_t v = current;
+        PARAMS_BARRIER();
+        *out = slot[v & 1];
+        PARAMS_BARRIER();
+        if (slot_version[v & 1] == v) {
+            return v;
+        }
+    }
+}
+
+void ParamBlock::write(const PaceParams &p) {
+    uint32_t v = current + 1;
+    // Invalidate the slot first so a reader still copying it retries
+    slot_version[v & 1] = ~(uint32_t) 0;
+    PARAMS_BARRIER();
+    slot[v & 1] = p;
+    PARAMS_BARRIER();
+    slot_version[v & 1] = v;
+    PARAMS_BARRIER();
+    current = v;
+}
+
+uint32_t ParamBlock::version() const {
+    return current;
+}
@@ -0,0 +1,71 @@
+#ifndef PARAMS_H
+#define PARAMS_H
+
+#include <stdint.h>
+
+// Pacemaker timing parameters that can be changed at runtime. The pacing
+// thread takes one snapshot per decision while the console thread may be
+// publishing a new version.
+
+// Defaults, in ms
+#define AVI_max 100
+#define AVI_min 30
+#define PVARP 500
+#define VRP 500 
+#define PVARP_EXTEND 50
+
+#define PARAMS_FILE "/local/params.txt"
+
+struct PaceParams {
+    // Indexed by Pacemode
+    int lri[4];
+    int uri[4];
+    int avi_min;
+    int avi_max;
+    int pvarp;
+    int vrp;
+    int pvarp_extend;
+    // Feature switches, 0 or 1
+    int extend_pvarp;
+    int dynamic_avi;
+};
+
+void params_defaults(PaceParams *p);
+
+// Set one parameter by name. Returns 0, -1 for an unknown name, or -2 when
+// the value is out of range or leaves the set inconsistent (URI above LRI,
+// AVI_min above AVI_max).
+int params_set(PaceParams *p, const char *name, int value);
+
+// Number of parameters and the name/value of the i-th, for listing
+int params_count();
+const char *params_name(int i);
+int params_get(const PaceParams *p, int i);
+
+// Persist as name=value lines. load applies every valid line over p and
+// returns the number applied, or -1 when the file cannot be opened.
+bool params_save(const PaceParams *p, const char *path);
+int params_load(PaceParams *p, const char *path);
+
+// Double-buffered, versioned parameter block. A reader copies the slot of
+// the latest version and never waits on a writer, even one preempted in the
+// middle of publishing; it retries only if two newer versions were
+// published during its copy. Writers must be serialized by the caller.
+class ParamBlock {
+    public:
+    ParamBlock();
+    
+    // Returns the version of the snapshot copied into out
+    uint32_t read(PaceParams *out) const;
+    
+    void write(const PaceParams &p);
+    
+    uint32_t version() const;
+    
+    private:
+    PaceParams slot[2];
+    volatile uint32_t slot_version[2];
+    volatile uint32_t current;
+};
+
+#endif
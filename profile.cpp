@@ -0,0 +1,266 @@
+#include "profile.h"
+#include "format.h"
+#include <string.h>
+
+#ifdef PROFILE
+
+#ifdef TARGET_LPC1768
+
+#include "mbed.h"
+#include "rtos.h"
+
+#define DEMCR (*(volatile uint32_t *) 0xE000EDFC)
+#define DEMCR_TRCENA (1u << 24)
+#define DWT_CTRL (*(volatile uint32_t *) 0xE0001000)
+#define DWT_CTRL_CYCCNTENA 1u
+#define DWT_CYCCNT (*(volatile uint32_t *) 0xE0001004)
+
+static osThreadId thread_ids[PROFILE_THREADS];
+static int thread_current[PROFILE_THREADS];
+static int threads = 0;
+static int isr_current = -1;
+
+uint32_t profile_clock() {
+    return DWT_CYCCNT;
+}
+
+const char *profile_unit() {
+    return "cycles";
+}
+
+static uint32_t lock() {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    return primask;
+}
+
+static void unlock(uint32_t primask) {
+    __set_PRIMASK(primask);
+}
+
+// Innermost open node of the running thread or interrupt. Interrupts
+// share one slot, which works because a preempting handler returns
+// before the one it preempted continues.
+static int *current_slot() {
+    if (__get_IPSR() != 0) {
+        return &isr_current;
+    }
+    osThreadId id = osThreadGetId();
+    for (int i = 0; i < threads; i++) {
+        if (thread_ids[i] == id) {
+            return &thread_current[i];
+        }
+    }
+    uint32_t primask = lock();
+    int i = threads < PROFILE_THREADS ? threads++ : PROFILE_THREADS - 1;
+    thread_ids[i] = id;
+    thread_current[i] = -1;
+    unlock(primask);
+    return &thread_current[i];
+}
+
+void profile_init() {
+    DEMCR |= DEMCR_TRCENA;
+    DWT_CYCCNT = 0;
+    DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+}
+
+#else
+
+#include <pthread.h>
+#include <time.h>
+
+static pthread_mutex_t profile_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread int current = -1;
+
+uint32_t profile_clock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) ((uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec);
+}
+
+const char *profile_unit() {
+    return "ns";
+}
+
+static uint32_t lock() {
+    pthread_mutex_lock(&profile_mutex);
+    return 0;
+}
+
+static void unlock(uint32_t) {
+    pthread_mutex_unlock(&profile_mutex);
+}
+
+static int *current_slot() {
+    return &current;
+}
+
+void profile_init() {
+}
+
+#endif
+
+static ProfileNode nodes[PROFILE_NODES];
+static int node_count = 0;
+static uint32_t dropped = 0;
+
+int profile_enter(ProfileProbe *probe) {
+    int *slot = current_slot();
+    int parent = *slot;
+    int node = probe->hint;
+    if (node < 0 || nodes[node].probe != probe || nodes[node].parent != parent) {
+        uint32_t primask = lock();
+        node = -1;
+        for (int i = 0; i < node_count && node < 0; i++) {
+            if (nodes[i].probe == probe && nodes[i].parent == parent) {
+                node = i;
+            }
+        }
+        if (node < 0 && node_count < PROFILE_NODES) {
+            node = node_count;
+            memset(&nodes[node], 0, sizeof(ProfileNode));
+            nodes[node].probe = probe;
+            nodes[node].parent = parent;
+            nodes[node].min = 0xFFFFFFFF;
+            node_count++;
+        }
+        if (node < 0) {
+            dropped++;
+        }
+        unlock(primask);
+        if (node < 0) {
+            return -1;
+        }
+        probe->hint = node;
+    }
+    *slot = node;
+    return node;
+}
+
+void profile_exit(int node, uint32_t elapsed) {
+    if (node < 0) {
+        return;
+    }
+    ProfileNode *n = &nodes[node];
+    uint32_t primask = lock();
+    n->calls++;
+    n->total += elapsed;
+    if (elapsed < n->min) n->min = elapsed;
+    if (elapsed > n->max) n->max = elapsed;
+    unlock(primask);
+    *current_slot() = n->parent;
+}
+
+// Counters only; the tree stays, as open scopes still point into it
+void profile_reset() {
+    uint32_t primask = lock();
+    for (int i = 0; i < node_count; i++) {
+        nodes[i].calls = 0;
+        nodes[i].total = 0;
+        nodes[i].min = 0xFFFFFFFF;
+        nodes[i].max = 0;
+    }
+    dropped = 0;
+    unlock(primask);
+}
+
+static uint64_t self_time(int node) {
+    uint64_t self = nodes[node].total;
+    for (int i = 0; i < node_count; i++) {
+        if (nodes[i].parent == node) {
+            self = self > nodes[i].total ? self - nodes[i].total : 0;
+        }
+    }
+    return self;
+}
+
+static void dump_folded(void (*out)(const char *s, int n)) {
+    int path[PROFILE_NODES];
+    FormatBuffer<160> line;
+    for (int i = 0; i < node_count; i++) {
+        if (nodes[i].calls == 0) continue;
+        int depth = 0;
+        for (int n = i; n >= 0 && depth < PROFILE_NODES; n = nodes[n].parent) {
+            path[depth++] = n;
+        }
+        line.clear();
+        line << "\n\r";
+        while (depth > 0) {
+            depth--;
+            line << nodes[path[depth]].probe->name << (depth > 0 ? ";" : " ");
+        }
+        line << (unsigned long long) self_time(i);
+        out(line.c_str(), line.length());
+    }
+}
+
+// Depth first, children in the order they were first entered
+static void dump_table(void (*out)(const char *s, int n)) {
+    FormatBuffer<128> line;
+    line << "\n\r     calls        total      min      max name (" <<
+        profile_unit() << ")";
+    out(line.c_str(), line.length());
+    int stack[PROFILE_NODES];
+    int depth[PROFILE_NODES];
+    int top = 0;
+    for (int i = node_count - 1; i >= 0; i--) {
+        if (nodes[i].parent < 0) {
+            stack[top] = i;
+            depth[top++] = 0;
+        }
+    }
+    while (top > 0) {
+        top--;
+        int n = stack[top];
+        int d = depth[top];
+        const ProfileNode *p = &nodes[n];
+        line.clear();
+        line << "\n\r" << pad(p->calls, 10) << ' ';
+        FormatBuffer<24> total;
+        total << (unsigned long long) p->total;
+        for (int k = total.length(); k < 12; k++) line << ' ';
+        line << total.c_str() << ' ' << pad(p->calls ? p->min : 0, 8) << ' '
+            << pad(p->max, 8) << ' ';
+        for (int k = 0; k < d; k++) line << "  ";
+        line << p->probe->name;
+        out(line.c_str(), line.length());
+        for (int i = node_count - 1; i >= 0; i--) {
+            if (nodes[i].parent == n && top < PROFILE_NODES) {
+                stack[top] = i;
+                depth[top++] = d + 1;
+            }
+        }
+    }
+    line.clear();
+    line << "\n\r" << node_count << '/' << PROFILE_NODES << " nodes, " <<
+        dropped << " calls dropped";
+    out(line.c_str(), line.length());
+}
+
+void profile_dump(void (*out)(const char *s, int n), bool folded) {
+    if (folded) {
+        dump_folded(out);
+    } else {
+        dump_table(out);
+    }
+}
+
+#else
+
+const char *profile_unit() {
+    return "";
+}
+
+void profile_init() {
+}
+
+void profile_reset() {
+}
+
+void profile_dump(void (*out)(const char *s, int n), bool /*folded*/) {
+    const char *s = "\n\rProfiling not built in, build with -DPROFILE";
+    out(s, strlen(s));
+}
+
+#endif
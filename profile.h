@@ -0,0 +1,85 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+
+// Scoped probes timing the code they enclose, built only with -DPROFILE:
+//
+//   void Logger::log(const char *c) {
+//       PROFILE_SCOPE("log");
+//       ...
+//
+// On the LPC1768 they count core cycles with the DWT cycle counter, on the
+// host nanoseconds from clock_gettime. Every probe is a node of a call tree
+// under whichever probe was open when it was entered, separately for each
+// thread and for interrupts, in a fixed table of PROFILE_NODES; calls that
+// would need a node beyond it are counted as dropped. Each node keeps
+// calls and total/min/max time. profile_dump() writes the table, or folded
+// stacks ("a;b;c <self time>") for flamegraph.pl, each line starting with
+// "\n\r" like the rest of the console: tr -d '\r' before flamegraph.pl.
+//
+// Without PROFILE the probes expand to nothing and profile_dump() only
+// says so.
+
+#define PROFILE_NODES 48
+// Threads with their own nesting; more than this share the last slot
+#define PROFILE_THREADS 12
+
+struct ProfileProbe {
+    const char *name;
+    // Node this probe last used, checked first
+    int hint;
+};
+
+struct ProfileNode {
+    const ProfileProbe *probe;
+    int parent;
+    uint32_t calls;
+    uint64_t total;
+    uint32_t min;
+    uint32_t max;
+};
+
+#ifdef PROFILE
+
+uint32_t profile_clock();
+int profile_enter(ProfileProbe *probe);
+void profile_exit(int node, uint32_t elapsed);
+
+class ProfileScope {
+    public:
+    ProfileScope(ProfileProbe *probe) {
+        node = profile_enter(probe);
+        start = profile_clock();
+    }
+    ~ProfileScope() {
+        profile_exit(node, profile_clock() - start);
+    }
+    
+    private:
+    int node;
+    uint32_t start;
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#define PROFILE_SCOPE(name) \
+    static ProfileProbe PROFILE_CONCAT(profile_probe_, __LINE__) = { name, -1 }; \
+    ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)( \
+        &PROFILE_CONCAT(profile_probe_, __LINE__))
+
+#else
+
+#define PROFILE_SCOPE(name)
+
+#endif
+
+// Unit of the times, "cycles" or "ns"
+const char *profile_unit();
+// Start counting; on the target this enables the cycle counter
+void profile_init();
+void profile_reset();
+// Write the table, or with folded the stacks, through out
+void profile_dump(void (*out)(const char *s, int n), bool folded);
+
+#endif
@@ -0,0 +1,40 @@
+#include "pulse.h"
+
+Pulse::Pulse(PinName pin, int _width_us) : out(pin, 0) {
+    width_us = _width_us;
+    active = false;
+    complete = NULL;
+}
+
+void Pulse::fire() {
+    timeout.detach();
+    active = true;
+    out = 1;
+    timeout.attach_us(this, &Pulse::end, width_us);
+}
+
+void Pulse::set_width(int _width_us) {
+    if (_width_us > 0) {
+        width_us = _width_us;
+    }
+}
+
+int Pulse::get_width() {
+    return width_us;
+}
+
+bool Pulse::busy() {
+    return active;
+}
+
+void Pulse::on_complete(void (*fn)()) {
+    complete = fn;
+}
+
+void Pulse::end() {
+    out = 0;
+    active = false;
+    if (complete != NULL) {
+        complete();
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef PULSE_H
+#define PULSE_H
+
+#include "mbed.h"
+
+// Default pulse width on the pace/sense wires
+#define PULSE_WIDTH_US 5000
+
+// Drives a single output pin high for a fixed width. The falling edge is
+// produced by a hardware Timeout, so the caller never blocks.
+class Pulse {
+    public:
+    
+    Pulse(PinName pin, int _width_us = PULSE_WIDTH_US);
+    
+    // Raise the pin and schedule it to drop. Firing while a pulse is still
+    // high restarts the width from now.
+    void fire();
+    
+    void set_width(int _width_us);
+    
+    int get_width();
+    
+    bool busy();
+    
+    // Called from interrupt context when the pin drops
+    void on_complete(void (*fn)());
+    
+    private:
+    DigitalOut out;
+    Timeout timeout;
+    int width_us;
+    volatile bool active;
+    void (*complete)();
+    
+    void end();
+};
+
+#endif
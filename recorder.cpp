@@ -0,0 +1,102 @@
+#include "recorder.h"
+#include "format.h"
+
+int Recorder::dropped = 0;
+Mutex Recorder::file_mutex;
+FILE* Recorder::tracefile = NULL;
+char Recorder::buffer[RECORDER_BUFFER];
+TraceRecord Recorder::ring[RECORDER_RING];
+volatile int Recorder::head = 0;
+volatile int Recorder::tail = 0;
+uint32_t Recorder::last_ticks = 0;
+uint64_t Recorder::high_ticks = 0;
+
+void Recorder::create_trace_file(int board) {
+    FormatBuffer<32> filename;
+    int n = 0;
+    
+    while(1) {
+        filename.clear();
+        filename << "/local/trc" << pad(n, 3, '0') << ".bin";
+        FILE *fp = fopen(filename.c_str(), "r");
+        if(fp == NULL) {
+            break;
+        }
+        fclose(fp);
+        n++;
+    }
+    
+    TraceHeader header;
+    header.magic = TRACE_MAGIC;
+    header.version = TRACE_VERSION;
+    header.header_size = sizeof(TraceHeader);
+    header.board = board;
+    header.reserved = 0;
+    
+    Recorder::tracefile = fopen(filename.c_str(), "wb");
+    if (Recorder::tracefile != NULL) {
+        setvbuf(Recorder::tracefile, Recorder::buffer, _IOFBF, RECORDER_BUFFER);
+        fwrite(&header, sizeof(header), 1, Recorder::tracefile);
+    }
+}
+
+void Recorder::close_trace_file() {
+    file_mutex.lock();
+    drain();
+    if (Recorder::tracefile != NULL) {
+        fclose(Recorder::tracefile);
+        Recorder::tracefile = NULL;
+    }
+    file_mutex.unlock();
+}
+
+bool Recorder::is_open() {
+    return Recorder::tracefile != NULL;
+}
+
+uint64_t Recorder::now_us() {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t t = us_ticker_read();
+    if (t < last_ticks) {
+        high_ticks += (uint64_t) 1 << 32;
+    }
+    last_ticks = t;
+    uint64_t now = high_ticks | t;
+    __set_PRIMASK(primask);
+    return now;
+}
+
+void Recorder::record(int pin, int level) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    int next = (head + 1) % RECORDER_RING;
+    if (next == tail) {
+        dropped++;
+    } else {
+        ring[head] = trace_pack(now_us(), pin, level);
+        head = next;
+    }
+    __set_PRIMASK(primask);
+}
+
+void Recorder::flush() {
+    file_mutex.lock();
+    drain();
+    file_mutex.unlock();
+}
+
+// file_mutex held
+void Recorder::drain() {
+    now_us();
+    int end = head;
+    while (tail != end) {
+        // Write up to the end of the ring, then wrap
+        int stop = end > tail ? end : RECORDER_RING;
+        if (Recorder::tracefile != NULL) {
+            fwrite(&ring[tail], sizeof(TraceRecord), stop - tail,
+                Recorder::tracefile);
+        }
+        tail = stop % RECORDER_RING;
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include "mbed.h"
+#include "rtos.h"
+#include "trace.h"
+
+// Edges waiting to be written; 8 bytes each
+#define RECORDER_RING 256
+// Static stdio buffer of the trace file
+#define RECORDER_BUFFER 512
+
+// Captures pin edges with microsecond timestamps into a ring buffer that
+// record() fills from interrupt context and flush() drains to
+// /local/trcNNN.bin from a thread. flush() and close_trace_file() may
+// run on different threads; once closed, flush() only empties the ring.
+class Recorder {
+    public:
+    
+    // board is TRACE_BOARD_HEART or TRACE_BOARD_PACE
+    static void create_trace_file(int board);
+    static void close_trace_file();
+    
+    static void record(int pin, int level);
+    static void flush();
+    
+    // Whether the trace file is still open for flush()
+    static bool is_open();
+    
+    // 64-bit microsecond clock. Must be read at least once every 71 minutes
+    // to catch the wrap of the 32-bit ticker; flush() does so.
+    static uint64_t now_us();
+    
+    // Edges lost because the ring was full
+    static int dropped;
+    
+    private:
+    
+    // Held over every file access, so a write never races the close
+    static Mutex file_mutex;
+    static FILE *tracefile;
+    static char buffer[RECORDER_BUFFER];
+    static TraceRecord ring[RECORDER_RING];
+    static volatile int head;
+    static volatile int tail;
+    static uint32_t last_ticks;
+    static uint64_t high_ticks;
+    
+    static void drain();
+};
+
+#endif
@@ -0,0 +1,169 @@
+#include "rhythm.h"
+
+const char *rhythm_name[] = {
+    "random", "sinus", "brady", "avblock", "pvc", "afib", "exercise"
+};
+
+static uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static inline uint32_t rotl(uint32_t x, int k) {
+    return (x << k) | (x >> (32 - k));
+}
+
+Rng::Rng(uint64_t seed) {
+    this->seed(seed);
+}
+
+void Rng::seed(uint64_t seed) {
+    uint64_t a = splitmix64(&seed);
+    uint64_t b = splitmix64(&seed);
+    s[0] = (uint32_t) a;
+    s[1] = (uint32_t) (a >> 32);
+    s[2] = (uint32_t) b;
+    s[3] = (uint32_t) (b >> 32);
+}
+
+uint32_t Rng::next() {
+    uint32_t result = rotl(s[1] * 5, 7) * 9;
+    uint32_t t = s[1] << 9;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 11);
+    return result;
+}
+
+uint32_t Rng::below(uint32_t n) {
+    return (uint32_t) (((uint64_t) next() * n) >> 32);
+}
+
+int Rng::jitter(int w) {
+    return (int) below(w + 1) + (int) below(w + 1) - w;
+}
+
+Rhythm::Rhythm(RhythmProfile _profile, uint64_t seed) {
+    reset(_profile, seed);
+}
+
+void Rhythm::reset(RhythmProfile _profile, uint64_t seed) {
+    profile = _profile;
+    rng.seed(seed);
+    phase = 0;
+    ramp_rr = 900;
+    ramp_step = -4;
+    carry = 0;
+    qhead = 0;
+    qlen = 0;
+}
+
+void Rhythm::fill(Beat *out, int n) {
+    for (int i = 0; i < n; i++) {
+        if (qhead == qlen) {
+            cycle();
+        }
+        out[i] = queue[qhead++];
+    }
+}
+
+Beat Rhythm::next() {
+    Beat b;
+    fill(&b, 1);
+    return b;
+}
+
+// Queue an event at offset ms into the current cycle. Offsets must be
+// non-decreasing within a cycle.
+void Rhythm::emit(int offset, int chamber, int *last) {
+    int interval = offset - *last + carry;
+    carry = 0;
+    *last = offset;
+    queue[qlen].interval = (uint16_t) (interval > 0 ? interval : 0);
+    queue[qlen].chamber = (uint8_t) chamber;
+    qlen++;
+}
+
+void Rhythm::cycle() {
+    int last = 0;
+    int rr;
+    qhead = 0;
+    qlen = 0;
+    
+    switch (profile) {
+    case RHYTHM_SINUS: {
+        // Respiratory sinus arrhythmia as a triangle over 8 beats
+        int resp = phase % 8;
+        resp = (resp < 4 ? resp : 8 - resp) * 30 - 60;
+        rr = 900 + resp + rng.jitter(40);
+        emit(0, RHYTHM_A, &last);
+        emit(75 + rng.jitter(10), RHYTHM_V, &last);
+        break;
+    }
+    case RHYTHM_BRADY:
+        rr = 1800 + rng.jitter(300);
+        emit(0, RHYTHM_A, &last);
+        emit(80 + rng.jitter(10), RHYTHM_V, &last);
+        break;
+    case RHYTHM_AV_BLOCK:
+        rr = 1000 + rng.jitter(30);
+        emit(0, RHYTHM_A, &last);
+        if (phase % 4 != 3) {
+            emit(60 + 20 * (phase % 4) + rng.jitter(5), RHYTHM_V, &last);
+        }
+        break;
+    case RHYTHM_PVC:
+        rr = 850 + rng.jitter(40);
+        if (rng.below(10) == 0) {
+            // Premature V, the next sinus A falls in its refractory period
+            // and is not conducted, then a full compensatory pause
+            emit(rr * 6 / 10, RHYTHM_V, &last);
+            emit(rr, RHYTHM_A, &last);
+            rr = 2 * rr;
+        } else {
+            emit(0, RHYTHM_A, &last);
+            emit(75 + rng.jitter(10), RHYTHM_V, &last);
+        }
+        break;
+    case RHYTHM_AFIB: {
+        rr = 450 + (int) rng.below(700);
+        emit(0, RHYTHM_V, &last);
+        int f = 100 + (int) rng.below(80);
+        while (f < rr - 40) {
+            emit(f, RHYTHM_A, &last);
+            f += 100 + (int) rng.below(80);
+        }
+        break;
+    }
+    case RHYTHM_EXERCISE:
+        // Ramp down to 400 ms, hold for 60 beats, ramp back up to 900 ms
+        if (ramp_step < 0 && ramp_rr <= 400) {
+            ramp_step = 0;
+            phase = 0;
+        } else if (ramp_step == 0 && phase >= 60) {
+            ramp_step = 4;
+        } else if (ramp_step > 0 && ramp_rr >= 900) {
+            ramp_step = -4;
+        }
+        ramp_rr += ramp_step;
+        rr = ramp_rr + rng.jitter(15);
+        emit(0, RHYTHM_A, &last);
+        emit(60 + (ramp_rr - 400) / 20 + rng.jitter(5), RHYTHM_V, &last);
+        break;
+    case RHYTHM_RANDOM:
+    default:
+        // One event per cycle, placed at the end so the interval is the
+        // uniform draw itself as in the original RANDOM mode
+        rr = (int) rng.below(3000);
+        emit(rr, rng.below(2) ? RHYTHM_A : RHYTHM_V, &last);
+        break;
+    }
+    
+    phase++;
+    carry = rr - last;
+}
@@ -0,0 +1,84 @@
+#ifndef RHYTHM_H
+#define RHYTHM_H
+
+#include <stdint.h>
+
+// Intrinsic heart rhythm generation shared by the heart firmware and the
+// host simulators. Integer only, no mbed dependency.
+
+#define RHYTHM_A 0
+#define RHYTHM_V 1
+
+enum RhythmProfile {
+    RHYTHM_RANDOM,      // Uniform 0-3 s, coin flip between AS and VS
+    RHYTHM_SINUS,       // ~65 BPM with respiratory variability
+    RHYTHM_BRADY,       // 28-40 BPM, below the NORMAL mode LRI
+    RHYTHM_AV_BLOCK,    // Wenckebach 4:3, PR grows until a V is dropped
+    RHYTHM_PVC,         // Sinus with premature ventricular beats
+    RHYTHM_AFIB,        // Fibrillatory atrial activity, irregular V
+    RHYTHM_EXERCISE,    // Ramp 65 -> 150 BPM and back
+    RHYTHM_COUNT
+};
+
+extern const char *rhythm_name[];
+
+// One intrinsic event: wait interval ms after the previous event, then
+// sense chamber (RHYTHM_A or RHYTHM_V)
+struct Beat {
+    uint16_t interval;
+    uint8_t chamber;
+};
+
+// xoshiro128** seeded through splitmix64. Small state, 32-bit ops only,
+// and the same sequence on every platform for a given seed.
+class Rng {
+    public:
+    uint32_t s[4];
+    
+    Rng(uint64_t seed = 1);
+    
+    void seed(uint64_t seed);
+    
+    uint32_t next();
+    
+    // Uniform in [0, n)
+    uint32_t below(uint32_t n);
+    
+    // Triangular in [-w, w]
+    int jitter(int w);
+};
+
+class Rhythm {
+    public:
+    RhythmProfile profile;
+    Rng rng;
+    
+    Rhythm(RhythmProfile _profile = RHYTHM_RANDOM, uint64_t seed = 1);
+    
+    // Switch profile and restart its sequence from seed
+    void reset(RhythmProfile _profile, uint64_t seed);
+    
+    // Write the next n events to out
+    void fill(Beat *out, int n);
+    
+    Beat next();
+    
+    private:
+    // Beat counter within the profile's cycle
+    int phase;
+    // Current RR for the exercise ramp, and its direction
+    int ramp_rr;
+    int ramp_step;
+    // ms from the last queued event to the end of its cycle
+    int carry;
+    
+    // Events of the cycle being handed out
+    Beat queue[16];
+    int qhead;
+    int qlen;
+    
+    void cycle();
+    void emit(int offset, int chamber, int *last);
+};
+
+#endif
@@ -0,0 +1,148 @@
+#include "script.h"
+#include "signals.h"
+#include <string.h>
+
+static const char *event_names[] = { "AP", "AS", "VP", "VS" };
+
+int script_event(const char *s) {
+    for (int i = 0; i < 4; i++) {
+        if (strncmp(s, event_names[i], 2) == 0 && (s[2] == '\0' || s[2] == ' ')) {
+            return 1 << i;
+        }
+    }
+    return 0;
+}
+
+const char *script_event_name(int event) {
+    for (int i = 0; i < 4; i++) {
+        if (event == 1 << i) return event_names[i];
+    }
+    return "?";
+}
+
+static const char *skip_spaces(const char *s) {
+    while (*s == ' ' || *s == '\t') s++;
+    return s;
+}
+
+// Reads a decimal number, returning the text after it or NULL if none
+static const char *read_number(const char *s, uint32_t *value) {
+    if (*s < '0' || *s > '9') return NULL;
+    *value = 0;
+    while (*s >= '0' && *s <= '9') {
+        *value = *value * 10 + (*s - '0');
+        s++;
+    }
+    return skip_spaces(s);
+}
+
+static bool keyword(const char *s, const char *word) {
+    int n = strlen(word);
+    return strncmp(s, word, n) == 0 &&
+        (s[n] == '\0' || s[n] == ' ' || s[n] == '\t');
+}
+
+Script::Script() {
+    clear();
+}
+
+void Script::clear() {
+    count = 0;
+    depth = 0;
+    error_line = 0;
+    error = NULL;
+}
+
+bool Script::fail(int line, const char *why) {
+    if (error_line == 0) {
+        error_line = line;
+        error = why;
+    }
+    return false;
+}
+
+ScriptStep *Script::add(int op, int line) {
+    if (count == SCRIPT_STEPS) return NULL;
+    ScriptStep *step = &steps[count++];
+    step->op = op;
+    step->line = line;
+    step->arg = 0;
+    step->event = 0;
+    step->command[0] = '\0';
+    return step;
+}
+
+bool Script::parse_line(const char *text, int line) {
+    if (error_line != 0) return false;
+    char buf[SCRIPT_LINE];
+    int n = 0;
+    while (text[n] != '\0' && text[n] != '#' && text[n] != '\r' &&
+            text[n] != '\n' && n < SCRIPT_LINE - 1) {
+        buf[n] = text[n];
+        n++;
+    }
+    while (n > 0 && (buf[n - 1] == ' ' || buf[n - 1] == '\t')) n--;
+    buf[n] = '\0';
+    const char *s = skip_spaces(buf);
+    if (*s == '\0') return true;
+    
+    if (keyword(s, "wait")) {
+        ScriptStep *step = add(SCRIPT_WAIT, line);
+        if (step == NULL) return fail(line, "too many steps");
+        s = skip_spaces(s + 4);
+        step->event = script_event(s);
+        if (step->event != 0) {
+            s = skip_spaces(s + 2);
+            if (*s == '\0') return true;
+        }
+        s = read_number(s, &step->arg);
+        if (s == NULL || *s != '\0') return fail(line, "wait [AP|AS|VP|VS] [ms]");
+        return true;
+    }
+    if (keyword(s, "loop")) {
+        if (depth == SCRIPT_DEPTH) return fail(line, "loops nested too deep");
+        ScriptStep *step = add(SCRIPT_LOOP, line);
+        if (step == NULL) return fail(line, "too many steps");
+        s = skip_spaces(s + 4);
+        if (*s != '\0') {
+            s = read_number(s, &step->arg);
+            if (s == NULL || *s != '\0') return fail(line, "loop [n]");
+        }
+        open[depth++] = count - 1;
+        return true;
+    }
+    if (keyword(s, "end")) {
+        if (depth == 0) return fail(line, "end without loop");
+        ScriptStep *step = add(SCRIPT_END, line);
+        if (step == NULL) return fail(line, "too many steps");
+        step->arg = open[--depth];
+        return true;
+    }
+    
+    ScriptStep *step = add(SCRIPT_SEND, line);
+    if (step == NULL) return fail(line, "too many steps");
+    if (*s == '+') {
+        s = read_number(s + 1, &step->arg);
+        if (s == NULL || *s == '\0') return fail(line, "+<ms> <command>");
+    }
+    if ((int) strlen(s) >= SCRIPT_COMMAND) return fail(line, "command too long");
+    strcpy(step->command, s);
+    return true;
+}
+
+bool Script::finish() {
+    if (error_line != 0) return false;
+    if (depth != 0) return fail(steps[open[depth - 1]].line, "loop without end");
+    // A forever loop must send or wait, which is where playback looks for
+    // the key that stops it
+    for (int i = 0; i < count; i++) {
+        if (steps[i].op != SCRIPT_LOOP || steps[i].arg != 0) continue;
+        bool blocks = false;
+        int j = i + 1;
+        for (; !(steps[j].op == SCRIPT_END && (int) steps[j].arg == i); j++) {
+            if (steps[j].op == SCRIPT_SEND || steps[j].op == SCRIPT_WAIT) blocks = true;
+        }
+        if (!blocks) return fail(steps[i].line, "loop forever without a send or wait");
+    }
+    return true;
+}
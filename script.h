@@ -0,0 +1,66 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include <stdint.h>
+
+// Console scripts, recorded and played back by console.cpp. Portable so
+// host tools can check a script before it goes to a board.
+//
+// One step per line, # starts a comment:
+//   +<ms> <command>    send command ms after the previous one
+//   <command>          send command straight away
+//   wait <ms>          pause
+//   wait <event> [ms]  wait for AP, AS, VP or VS, failing after ms
+//   loop [n]           repeat up to the matching end n times, 0 forever,
+//                      which needs a send or wait inside
+//   end
+
+#define SCRIPT_STEPS 48
+#define SCRIPT_COMMAND 20
+#define SCRIPT_DEPTH 4
+#define SCRIPT_LINE 64
+
+enum ScriptOp { SCRIPT_SEND, SCRIPT_WAIT, SCRIPT_LOOP, SCRIPT_END };
+
+struct ScriptStep {
+    // Delay or timeout in ms, loop count, or for an end its loop's step
+    uint32_t arg;
+    uint16_t line;
+    uint8_t op;
+    // Signal (signals.h) a wait is for, 0 for a plain pause
+    uint8_t event;
+    char command[SCRIPT_COMMAND];
+};
+
+class Script {
+    public:
+    ScriptStep steps[SCRIPT_STEPS];
+    int count;
+    // Line of the first error, 0 if none
+    int error_line;
+    const char *error;
+    
+    Script();
+    
+    void clear();
+    
+    // Adds the steps of one line. Returns false on an error, after which
+    // further lines are ignored.
+    bool parse_line(const char *text, int line);
+    
+    // Checks every loop is closed, once all lines are in
+    bool finish();
+    
+    private:
+    int open[SCRIPT_DEPTH];
+    int depth;
+    
+    bool fail(int line, const char *why);
+    ScriptStep *add(int op, int line);
+};
+
+// Signal for AP, AS, VP or VS at s, 0 otherwise
+int script_event(const char *s);
+const char *script_event_name(int event);
+
+#endif
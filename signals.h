@@ -0,0 +1,13 @@
+#ifndef SIGNALS_H
+#define SIGNALS_H
+
+// Thread signals shared by both boards. Board-specific signals start
+// at 0x0010 and must stay clear of these.
+#define AP          0x0001
+#define AS          0x0002
+#define VP          0x0004
+#define VS          0x0008
+#define INPUT_READY 0x0200
+#define INTERVAL_CHANGE 0x0400
+
+#endif
@@ -0,0 +1,130 @@
+#include "spinor.h"
+#include "rtos.h"
+
+#define CMD_READ 0x03
+#define CMD_PROGRAM 0x02
+#define CMD_ERASE_4K 0x20
+#define CMD_WRITE_ENABLE 0x06
+#define CMD_STATUS 0x05
+#define CMD_JEDEC_ID 0x9F
+
+#define STATUS_BUSY 0x01
+
+#define SECTOR 4096
+#define PAGE 256
+// Worst case sector erase is about 400 ms
+#define READY_POLLS 1000
+
+SpiNor::SpiNor(PinName mosi, PinName miso, PinName sclk, PinName _cs) :
+    spi(mosi, miso, sclk), cs(_cs, 1), bytes(0) {
+    spi.format(8, 0);
+    spi.frequency(SPINOR_HZ);
+}
+
+bool SpiNor::init() {
+    cs = 0;
+    spi.write(CMD_JEDEC_ID);
+    int maker = spi.write(0);
+    spi.write(0);
+    int capacity = spi.write(0);
+    cs = 1;
+    // A missing chip reads all ones or all zeros
+    if (maker == 0xFF || maker == 0x00 || capacity < 16 || capacity > 24) {
+        bytes = 0;
+        return false;
+    }
+    bytes = (uint32_t) 1 << capacity;
+    return true;
+}
+
+int SpiNor::read(uint32_t addr, void *data, uint32_t n) {
+    if (addr + n > bytes) {
+        return -1;
+    }
+    uint8_t *p = (uint8_t *) data;
+    command(CMD_READ, addr);
+    for (uint32_t i = 0; i < n; i++) {
+        p[i] = spi.write(0);
+    }
+    cs = 1;
+    return 0;
+}
+
+int SpiNor::program(uint32_t addr, const void *data, uint32_t n) {
+    if (addr % PAGE != 0 || n % PAGE != 0 || addr + n > bytes) {
+        return -1;
+    }
+    const uint8_t *p = (const uint8_t *) data;
+    for (uint32_t done = 0; done < n; done += PAGE) {
+        write_enable();
+        command(CMD_PROGRAM, addr + done);
+        for (int i = 0; i < PAGE; i++) {
+            spi.write(p[done + i]);
+        }
+        cs = 1;
+        if (wait_ready(false) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int SpiNor::erase(uint32_t addr, uint32_t n) {
+    if (addr % SECTOR != 0 || n % SECTOR != 0 || addr + n > bytes) {
+        return -1;
+    }
+    for (uint32_t done = 0; done < n; done += SECTOR) {
+        write_enable();
+        command(CMD_ERASE_4K, addr + done);
+        cs = 1;
+        if (wait_ready(true) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+uint32_t SpiNor::size() {
+    return bytes;
+}
+
+uint32_t SpiNor::erase_size() {
+    return SECTOR;
+}
+
+uint32_t SpiNor::program_size() {
+    return PAGE;
+}
+
+// Leaves cs low for the data phase
+void SpiNor::command(uint8_t op, uint32_t addr) {
+    cs = 0;
+    spi.write(op);
+    spi.write((addr >> 16) & 0xFF);
+    spi.write((addr >> 8) & 0xFF);
+    spi.write(addr & 0xFF);
+}
+
+void SpiNor::write_enable() {
+    cs = 0;
+    spi.write(CMD_WRITE_ENABLE);
+    cs = 1;
+}
+
+int SpiNor::wait_ready(bool sleep) {
+    for (int i = 0; i < READY_POLLS; i++) {
+        cs = 0;
+        spi.write(CMD_STATUS);
+        int status = spi.write(0);
+        cs = 1;
+        if (!(status & STATUS_BUSY)) {
+            return 0;
+        }
+        if (sleep) {
+            Thread::wait(1);
+        } else {
+            wait_us(10);
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,44 @@
+#ifndef SPINOR_H
+#define SPINOR_H
+
+#include "mbed.h"
+#include "blockdev.h"
+
+// Pins of the log flash on the SPI1 header, clear of the pace wires
+#define SPINOR_MOSI p11
+#define SPINOR_MISO p12
+#define SPINOR_SCK p13
+#define SPINOR_CS p14
+#define SPINOR_HZ 10000000
+
+// Common 25-series SPI NOR (W25Q, AT25SF, MX25L...) used through the
+// basic 3-byte address commands: 4 KB sector erase, 256 byte page program.
+class SpiNor : public BlockDevice {
+    public:
+    
+    SpiNor(PinName mosi, PinName miso, PinName sclk, PinName cs);
+    
+    // Read the JEDEC ID and size the device from it. Returns false when
+    // no flash answers.
+    bool init();
+    
+    virtual int read(uint32_t addr, void *data, uint32_t n);
+    virtual int program(uint32_t addr, const void *data, uint32_t n);
+    virtual int erase(uint32_t addr, uint32_t n);
+    
+    virtual uint32_t size();
+    virtual uint32_t erase_size();
+    virtual uint32_t program_size();
+    
+    private:
+    SPI spi;
+    DigitalOut cs;
+    uint32_t bytes;
+    
+    void command(uint8_t op, uint32_t addr);
+    void write_enable();
+    // Poll the busy bit, sleeping between polls when the wait is long
+    int wait_ready(bool sleep);
+};
+
+#endif
@@ -0,0 +1,44 @@
+#include "stacks.h"
+
+struct StackSlot {
+    const char *name;
+    uint32_t *base;
+    int words;
+};
+
+static StackSlot slots[STACK_SLOTS];
+static int slot_count = 0;
+
+unsigned char *stack_paint(const char *name, uint32_t *stack, int bytes) {
+    int words = bytes / sizeof(uint32_t);
+    for (int i = 0; i < words; i++) {
+        stack[i] = STACK_PAINT;
+    }
+    if (slot_count < STACK_SLOTS) {
+        slots[slot_count].name = name;
+        slots[slot_count].base = stack;
+        slots[slot_count].words = words;
+        slot_count++;
+    }
+    return (unsigned char *) stack;
+}
+
+int stack_count() {
+    return slot_count;
+}
+
+const char *stack_name(int i) {
+    return slots[i].name;
+}
+
+int stack_size(int i) {
+    return slots[i].words * sizeof(uint32_t);
+}
+
+int stack_peak(int i) {
+    int unused = 0;
+    while (unused < slots[i].words && slots[i].base[unused] == STACK_PAINT) {
+        unused++;
+    }
+    return (slots[i].words - unused) * sizeof(uint32_t);
+}
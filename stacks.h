@@ -0,0 +1,27 @@
+#ifndef STACKS_H
+#define STACKS_H
+
+#include "mbed.h"
+
+// Word every stack is filled with before its thread starts
+#define STACK_PAINT 0xE25A2EA5
+#define STACK_SLOTS 12
+
+// Statically allocated thread stack of the given size in bytes
+#define THREAD_STACK(name, bytes) \
+    static uint32_t name[(bytes) / sizeof(uint32_t)] __attribute__((aligned(8)))
+
+// Paints a stack and registers it for watermark reports. Returns it as
+// the stack_pointer argument of Thread:
+//   Thread log(log_thread, NULL, osPriorityNormal, sizeof(log_stack),
+//       stack_paint("log", log_stack, sizeof(log_stack)));
+unsigned char *stack_paint(const char *name, uint32_t *stack, int bytes);
+
+int stack_count();
+const char *stack_name(int i);
+int stack_size(int i);
+// High-water mark in bytes: the stack grows down, so the painted words
+// left at the bottom were never touched
+int stack_peak(int i);
+
+#endif
@@ -0,0 +1,91 @@
+#include "stress.h"
+
+const char *stress_name[] = {
+    "burst", "double", "noise", "dropout"
+};
+
+Stress::Stress(uint64_t seed) : rng(seed) {
+    start(STRESS_BURST, STRESS_RATE_MIN, STRESS_RATE_MAX, STRESS_STEP_MS, seed);
+}
+
+void Stress::start(StressPattern _pattern, int _rate_min, int _rate_max,
+        int _step_ms, uint64_t seed) {
+    pattern = _pattern;
+    rate_min = _rate_min > 0 ? _rate_min : 1;
+    rate_max = _rate_max > rate_min ? _rate_max : rate_min;
+    step_ms = _step_ms > 0 ? _step_ms : STRESS_STEP_MS;
+    rng.seed(seed);
+    elapsed_us = 0;
+    phase_us = pattern == STRESS_DROPOUT ? 1000000 : STRESS_BURST_MS * 1000;
+    pending_double = false;
+    double_chamber = RHYTHM_A;
+}
+
+int Stress::step() {
+    return (int) (elapsed_us / ((uint64_t) step_ms * 1000));
+}
+
+int Stress::rate() {
+    int r = rate_min;
+    int s = step();
+    for (int i = 0; i < s; i++) {
+        if (r == rate_max) {
+            return 0;
+        }
+        r = r * 2 < rate_max ? r * 2 : rate_max;
+    }
+    return r;
+}
+
+bool Stress::done() {
+    return rate() == 0;
+}
+
+uint32_t Stress::period_us() {
+    int r = rate();
+    return r > 0 ? 1000000 / r : 1000000;
+}
+
+StressEdge Stress::next() {
+    uint32_t period = period_us();
+    StressEdge e;
+    e.chamber = rng.below(2) ? RHYTHM_V : RHYTHM_A;
+    // Keep edges apart at high rates, so each one is its own rising edge
+    e.width_us = period / 2 < STRESS_WIDTH_US ? period / 2 : STRESS_WIDTH_US;
+    e.gap_us = period;
+    
+    switch (pattern) {
+    case STRESS_BURST:
+    case STRESS_DROPOUT:
+        e.gap_us = period + rng.jitter(period / 4);
+        phase_us -= e.gap_us;
+        if (phase_us <= 0) {
+            // The active stretch is over: this edge waits out a quiet one
+            e.gap_us += pattern == STRESS_BURST ?
+                STRESS_BURST_MS * 1000 : 2000000 + rng.below(4000001);
+            phase_us = pattern == STRESS_BURST ?
+                STRESS_BURST_MS * 1000 : 1000000;
+        }
+        break;
+    case STRESS_DOUBLE:
+        if (pending_double) {
+            e.chamber = double_chamber;
+            e.gap_us = 2000 + rng.below(38001);
+            pending_double = false;
+        } else {
+            e.gap_us = 2 * period > 42000 ? 2 * period - 21000 : period;
+            double_chamber = e.chamber;
+            pending_double = true;
+        }
+        if (e.width_us > e.gap_us / 2) e.width_us = e.gap_us / 2;
+        break;
+    case STRESS_NOISE:
+        e.gap_us = 1 + rng.below(2 * period);
+        e.width_us = 20 + rng.below(181);
+        break;
+    default:
+        break;
+    }
+    elapsed_us += e.gap_us;
+    return e;
+}
@@ -0,0 +1,71 @@
+#ifndef STRESS_H
+#define STRESS_H
+
+#include <stdint.h>
+#include "rhythm.h"
+
+// Sense edge storms for loading the pacemaker's interrupt and signal path,
+// shared by the heart firmware and host tools. Integer only, no mbed
+// dependency. The edge rate ramps from rate_min, doubling every step_ms,
+// up to rate_max, which is held for one more step before the run ends.
+
+enum StressPattern {
+    STRESS_BURST,       // Bursts of jittered AS/VS at the rate, then quiet
+    STRESS_DOUBLE,      // Every sense followed by a second one 2-40 ms on,
+                        // which caps it near 50 pairs per second
+    STRESS_NOISE,       // 20-200 us glitches on both leads, random spacing
+    STRESS_DROPOUT,     // A second of edges at the rate, then 2-6 s silent
+    STRESS_COUNT
+};
+
+extern const char *stress_name[];
+
+// Ramp defaults, in edges per second and ms
+#define STRESS_RATE_MIN 10
+#define STRESS_RATE_MAX 4000
+#define STRESS_STEP_MS 5000
+
+#define STRESS_BURST_MS 250
+#define STRESS_WIDTH_US 5000
+
+// One edge: wait gap_us after the previous one, then raise chamber
+// (RHYTHM_A or RHYTHM_V) for width_us
+struct StressEdge {
+    uint32_t gap_us;
+    uint16_t width_us;
+    uint8_t chamber;
+};
+
+class Stress {
+    public:
+    StressPattern pattern;
+    int rate_min;
+    int rate_max;
+    int step_ms;
+    
+    Stress(uint64_t seed = 1);
+    
+    void start(StressPattern _pattern, int _rate_min, int _rate_max,
+        int _step_ms, uint64_t seed);
+    
+    StressEdge next();
+    
+    // Edges per second of the current step, 0 once the ramp has ended
+    int rate();
+    // Step index, from 0
+    int step();
+    bool done();
+    
+    private:
+    Rng rng;
+    uint64_t elapsed_us;
+    // Time left in the current burst or dropout phase
+    int64_t phase_us;
+    // Second edge of a double sense still to come
+    bool pending_double;
+    uint8_t double_chamber;
+    
+    uint32_t period_us();
+};
+
+#endif
@@ -0,0 +1,124 @@
+#include "telemetry.h"
+#include <string.h>
+
+uint16_t crc16(const uint8_t *data, int n, uint16_t crc) {
+    for (int i = 0; i < n; i++) {
+        crc ^= (uint16_t) data[i] << 8;
+        for (int b = 0; b < 8; b++) {
+            crc = (crc & 0x8000) ? (uint16_t) ((crc << 1) ^ 0x1021) :
+                (uint16_t) (crc << 1);
+        }
+    }
+    return crc;
+}
+
+int cobs_encode(const uint8_t *in, int n, uint8_t *out) {
+    int code_at = 0;
+    int o = 1;
+    uint8_t code = 1;
+    for (int i = 0; i < n; i++) {
+        if (in[i] == 0) {
+            out[code_at] = code;
+            code_at = o++;
+            code = 1;
+        } else {
+            out[o++] = in[i];
+            code++;
+            if (code == 0xFF) {
+                out[code_at] = code;
+                code_at = o++;
+                code = 1;
+            }
+        }
+    }
+    out[code_at] = code;
+    return o;
+}
+
+int cobs_decode(const uint8_t *in, int n, uint8_t *out) {
+    int i = 0;
+    int o = 0;
+    while (i < n) {
+        uint8_t code = in[i++];
+        if (code == 0 || i + code - 1 > n) {
+            return -1;
+        }
+        for (int k = 1; k < code; k++) {
+            out[o++] = in[i++];
+        }
+        if (code != 0xFF && i < n) {
+            out[o++] = 0;
+        }
+    }
+    return o;
+}
+
+TelemetryTx::TelemetryTx() {
+    seq = 0;
+}
+
+int TelemetryTx::frame(uint8_t type, const uint8_t *payload, int n,
+        uint8_t *out) {
+    uint8_t raw[TELEMETRY_MAX_PAYLOAD + 4];
+    if (n > TELEMETRY_MAX_PAYLOAD) {
+        n = TELEMETRY_MAX_PAYLOAD;
+    }
+    raw[0] = type;
+    raw[1] = seq++;
+    memcpy(raw + 2, payload, n);
+    put_u16(raw + 2 + n, crc16(raw, 2 + n));
+    
+    out[0] = 0;
+    int len = cobs_encode(raw, n + 4, out + 1);
+    out[len + 1] = 0;
+    return len + 2;
+}
+
+TelemetryRx::TelemetryRx() {
+    frames = 0;
+    lost = 0;
+    corrupt = 0;
+    length = 0;
+    overflow = false;
+    synced = false;
+    expected = 0;
+}
+
+bool TelemetryRx::feed(uint8_t c, TelemetryFrame *out) {
+    if (c != 0) {
+        if (length < (int) sizeof(buffer)) {
+            buffer[length++] = c;
+        } else {
+            overflow = true;
+        }
+        return false;
+    }
+    
+    // Delimiter: an empty run is just the gap between two frames
+    int n = length;
+    bool too_long = overflow;
+    length = 0;
+    overflow = false;
+    if (n == 0) {
+        return false;
+    }
+    
+    uint8_t raw[TELEMETRY_MAX_FRAME];
+    int m = too_long ? -1 : cobs_decode(buffer, n, raw);
+    if (m < 4 || get_u16(raw + m - 2) != crc16(raw, m - 2)) {
+        corrupt++;
+        return false;
+    }
+    
+    out->type = raw[0];
+    out->seq = raw[1];
+    out->length = m - 4;
+    memcpy(out->payload, raw + 2, out->length);
+    if (synced) {
+        lost += (uint8_t) (out->seq - expected);
+    }
+    synced = true;
+    expected = (uint8_t) (out->seq + 1);
+    frames++;
+    return true;
+}
@@ -0,0 +1,92 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+
+// Framed binary telemetry over the serial link, shared by the firmware
+// (sender) and host tools (receiver). A frame is
+//
+//   type, seq, payload..., crc16 (little endian)
+//
+// COBS encoded and delimited by 0x00 on both sides. CRC is CRC-16/CCITT
+// over type, seq and payload. seq counts every frame sent, so a receiver
+// can tell how many were lost.
+
+#define TELEMETRY_MAX_PAYLOAD 64
+// type + seq + payload + crc, plus COBS overhead and two delimiters
+#define TELEMETRY_MAX_FRAME (TELEMETRY_MAX_PAYLOAD + 4 + 2 + 2)
+
+// Frame types
+#define FRAME_CONSOLE 0x01  // Console text
+#define FRAME_EVENT   0x02  // uint8 event (AP/AS/VP/VS bit), uint32 t_ms
+#define FRAME_STATS   0x03  // uint16 bpm * 10, uint16 beats, uint32 window_ms
+#define FRAME_VERDICT 0x04  // uint8 passed, uint8 heart mode, uint16 verdict number
+#define FRAME_MARGIN  0x05  // uint8 heart mode, test, step, signal, observed;
+                            // int32 window_us, observed_us, margin_us (margin.h)
+
+uint16_t crc16(const uint8_t *data, int n, uint16_t crc = 0xFFFF);
+
+// Return the encoded length; out needs n + n / 254 + 1 bytes
+int cobs_encode(const uint8_t *in, int n, uint8_t *out);
+
+// Return the decoded length, or -1 if the input is not valid COBS
+int cobs_decode(const uint8_t *in, int n, uint8_t *out);
+
+inline void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t) v;
+    p[1] = (uint8_t) (v >> 8);
+}
+
+inline void put_u32(uint8_t *p, uint32_t v) {
+    put_u16(p, (uint16_t) v);
+    put_u16(p + 2, (uint16_t) (v >> 16));
+}
+
+inline uint16_t get_u16(const uint8_t *p) {
+    return (uint16_t) (p[0] | (p[1] << 8));
+}
+
+inline uint32_t get_u32(const uint8_t *p) {
+    return get_u16(p) | ((uint32_t) get_u16(p + 2) << 16);
+}
+
+class TelemetryTx {
+    public:
+    uint8_t seq;
+    
+    TelemetryTx();
+    
+    // Build a complete frame, delimiters included, into out
+    // (TELEMETRY_MAX_FRAME bytes). Returns its length.
+    int frame(uint8_t type, const uint8_t *payload, int n, uint8_t *out);
+};
+
+struct TelemetryFrame {
+    uint8_t type;
+    uint8_t seq;
+    int length;
+    uint8_t payload[TELEMETRY_MAX_PAYLOAD];
+};
+
+class TelemetryRx {
+    public:
+    // Frames decoded, frames known lost from seq gaps, and frames dropped
+    // for bad COBS, length or CRC
+    long frames;
+    long lost;
+    long corrupt;
+    
+    TelemetryRx();
+    
+    // Feed one received byte. Returns true when out holds a new frame.
+    bool feed(uint8_t c, TelemetryFrame *out);
+    
+    private:
+    uint8_t buffer[TELEMETRY_MAX_FRAME];
+    int length;
+    bool overflow;
+    bool synced;
+    uint8_t expected;
+};
+
+#endif
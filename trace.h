@@ -0,0 +1,56 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// Pin edge trace format shared by the firmware recorder and host tools.
+// A trace file is a TraceHeader followed by 8-byte records in time order.
+// Each record packs a microsecond timestamp, the pin and the new level:
+//
+//   bits 63..4  time in us since the recorder started
+//   bits  3..1  pin (TRACE_AP .. TRACE_VS)
+//   bit      0  level after the edge
+
+#define TRACE_MAGIC 0x45435254
+#define TRACE_VERSION 1
+
+#define TRACE_AP 0
+#define TRACE_AS 1
+#define TRACE_VP 2
+#define TRACE_VS 3
+// In merged traces (host/trace_merge.cpp), pin + TRACE_REMOTE is the same
+// wire as seen by the pacemaker, on the heart's clock
+#define TRACE_REMOTE 4
+
+// Boards whose edges a trace holds, both in a merged one; 0 in traces
+// written before it was set
+#define TRACE_BOARD_HEART 1
+#define TRACE_BOARD_PACE 2
+
+struct TraceHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t board;
+    uint32_t reserved;
+};
+
+typedef uint64_t TraceRecord;
+
+inline TraceRecord trace_pack(uint64_t t_us, int pin, int level) {
+    return (t_us << 4) | ((uint64_t) (pin & 7) << 1) | (uint64_t) (level & 1);
+}
+
+inline uint64_t trace_time(TraceRecord r) {
+    return r >> 4;
+}
+
+inline int trace_pin(TraceRecord r) {
+    return (int) (r >> 1) & 7;
+}
+
+inline int trace_level(TraceRecord r) {
+    return (int) r & 1;
+}
+
+#endif